@@ -0,0 +1,360 @@
+/*
+Copyright 2017 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+
+// Microbenchmarks of MetricsGui's hot paths.  Runs every benchmark, or only
+// those named on the command line, and prints a table of results for each.
+// Build the release configuration for meaningful numbers.
+
+#define NOMINMAX // perf_timer.h includes windows.h on Windows
+#include <metrics_gui/metrics_gui.h>
+#include <metrics_gui/zone.h>
+#include "../portable/perf_timer.h"
+#include "../metrics_gui/source/kernels.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+namespace {
+
+double GetSeconds(
+    uint64_t ticks)
+{
+    auto frequency = GetPerfTimerFrequency();
+    return (double) ticks * frequency.Denominator / (double) frequency.Numerator;
+}
+
+// Runs threadCount threads calling call() for about 0.25 s, while the
+// calling thread calls frame() once per 16 ms frame like an application
+// would, and once more after the threads have stopped.  Returns the calls
+// per second, and the number of calls in callCount.
+template<typename CallFn, typename FrameFn>
+double MeasureCallRate(
+    uint32_t threadCount,
+    CallFn call,
+    FrameFn frame,
+    uint64_t* callCount)
+{
+    enum { BATCH_SIZE = 1024 };
+
+    std::atomic<uint32_t> readyCount(0);
+    std::atomic<bool> start(false);
+    std::atomic<bool> stop(false);
+    std::atomic<uint64_t> totalCount(0);
+
+    std::vector<std::thread> threads;
+    for (uint32_t i = 0; i < threadCount; ++i) {
+        threads.emplace_back([&]() {
+            readyCount.fetch_add(1);
+            while (!start.load()) {
+            }
+            uint64_t count = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                for (uint32_t j = 0; j < BATCH_SIZE; ++j) {
+                    call();
+                }
+                count += BATCH_SIZE;
+            }
+            totalCount.fetch_add(count);
+        });
+    }
+    while (readyCount.load() < threadCount) {
+    }
+
+    auto t0 = GetPerfTimerCount();
+    start.store(true);
+    for (uint32_t i = 0; i < 16; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(16));
+        frame();
+    }
+    stop.store(true);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    auto t1 = GetPerfTimerCount();
+    frame();
+
+    *callCount = totalCount.load();
+    return (double) *callCount / GetSeconds(t1 - t0);
+}
+
+// Compares MetricsGuiCounter against all threads incrementing one shared
+// atomic, from one thread up to twice the number of hardware threads.
+void BenchmarkCounter()
+{
+    auto maxThreadCount = std::max(2 * std::thread::hardware_concurrency(), 2u);
+
+    printf("Counter increments from N threads (millions per second)\n");
+    printf("%8s %16s %20s\n", "threads", "shared atomic", "MetricsGuiCounter");
+    for (uint32_t threadCount = 1; threadCount <= maxThreadCount; threadCount *= 2) {
+        std::atomic<uint64_t> shared(0);
+        uint64_t sharedCount = 0;
+        auto sharedRate = MeasureCallRate(
+            threadCount,
+            [&]() { shared.fetch_add(1, std::memory_order_relaxed); },
+            [&]() {},
+            &sharedCount);
+
+        MetricsGuiCounter counter("Increments", "", 0);
+        uint64_t counterCount = 0;
+        uint64_t collectedCount = 0;
+        auto counterRate = MeasureCallRate(
+            threadCount,
+            [&]() { counter.Increment(); },
+            [&]() { collectedCount += counter.Collect(); },
+            &counterCount);
+        if (collectedCount != counterCount) {
+            fprintf(stderr, "error: collected %llu of %llu increments\n",
+                (unsigned long long) collectedCount,
+                (unsigned long long) counterCount);
+        }
+
+        printf("%8u %16.1f %20.1f\n", threadCount, sharedRate * 1e-6, counterRate * 1e-6);
+    }
+    printf("\n");
+}
+
+// Seconds per call of fn(), timed over repeated calls for about 0.1 s.
+template<typename Fn>
+double MeasureCallTime(
+    Fn fn)
+{
+    uint64_t callCount = 0;
+    auto t0 = GetPerfTimerCount();
+    auto t1 = t0;
+    for (uint64_t batch = 1; GetSeconds(t1 - t0) < 0.1; batch *= 2) {
+        for (uint64_t i = 0; i < batch; ++i) {
+            fn();
+        }
+        callCount += batch;
+        t1 = GetPerfTimerCount();
+    }
+    return GetSeconds(t1 - t0) / (double) callCount;
+}
+
+// Compares the reductions UpdateAxes() does for a plot of N series, with
+// scalar loops and with the MetricsGuiKernels used by UpdateAxes():
+//     minmax:  min, max and sum of each series
+//     stacked: column-wise sum of all series, then the max of the sums
+void BenchmarkReduce()
+{
+#if defined(METRICS_GUI_AVX2)
+    auto isa = "AVX2";
+#elif defined(METRICS_GUI_SSE2)
+    auto isa = "SSE2";
+#elif defined(METRICS_GUI_NEON)
+    auto isa = "NEON";
+#else
+    auto isa = "scalar";
+#endif
+
+    printf("Reductions over N series of %u values (microseconds per plot, kernels use %s)\n", (uint32_t) MetricsGuiMetric::NUM_HISTORY_SAMPLES, isa);
+    printf("%8s %10s %10s %8s %10s %10s %8s\n", "series", "minmax", "kernels", "speedup", "stacked", "kernels", "speedup");
+
+    uint32_t const seriesCounts[] = { 8, 64, 512 };
+    for (auto seriesCount : seriesCounts) {
+        std::vector<MetricsGuiMetric> metrics(seriesCount, MetricsGuiMetric("Series", "", 0));
+        for (uint32_t s = 0; s < seriesCount; ++s) {
+            for (uint32_t i = 0; i < metrics[s].mHistorySize; ++i) {
+                metrics[s].AddNewValue((float) (((s + i) * 7919) % 1000) * 0.001f);
+            }
+        }
+        auto historySize = metrics[0].mHistorySize;
+        std::vector<double> stackedDoubles(historySize);
+        std::vector<float> stackedFloats(historySize);
+        volatile float sink = 0.f;
+
+        auto scalarMinMax = MeasureCallTime([&]() {
+            for (uint32_t s = 0; s < seriesCount; ++s) {
+                auto p = metrics[s].mHistory;
+                auto minValue = FLT_MAX;
+                auto maxValue = -FLT_MAX;
+                auto sum = 0.f;
+                for (uint32_t i = 0; i < historySize; ++i) {
+                    minValue = std::min(minValue, p[i]);
+                    maxValue = std::max(maxValue, p[i]);
+                    sum += p[i];
+                }
+                sink = minValue + maxValue + sum;
+            }
+        });
+        auto kernelMinMax = MeasureCallTime([&]() {
+            for (uint32_t s = 0; s < seriesCount; ++s) {
+                auto p = metrics[s].mHistory;
+                sink = MetricsGuiKernels::ReduceMin(p, historySize) +
+                       MetricsGuiKernels::ReduceMax(p, historySize) +
+                       MetricsGuiKernels::ReduceSum(p, historySize);
+            }
+        });
+
+        // The scalar version is the double precision loop UpdateAxes() used
+        // before the kernels.
+        auto scalarStacked = MeasureCallTime([&]() {
+            std::fill(stackedDoubles.begin(), stackedDoubles.end(), 0.);
+            for (uint32_t s = 0; s < seriesCount; ++s) {
+                auto p = metrics[s].mHistory;
+                for (uint32_t i = 0; i < historySize; ++i) {
+                    stackedDoubles[i] += p[i];
+                }
+            }
+            auto maxValue = 0.;
+            for (auto v : stackedDoubles) {
+                maxValue = std::max(maxValue, v);
+            }
+            sink = (float) maxValue;
+        });
+        auto kernelStacked = MeasureCallTime([&]() {
+            std::fill(stackedFloats.begin(), stackedFloats.end(), 0.f);
+            for (uint32_t s = 0; s < seriesCount; ++s) {
+                MetricsGuiKernels::Accumulate(stackedFloats.data(), metrics[s].mHistory, historySize);
+            }
+            sink = MetricsGuiKernels::ReduceMax(stackedFloats.data(), historySize);
+        });
+
+        printf("%8u %10.2f %10.2f %7.1fx %10.2f %10.2f %7.1fx\n",
+            seriesCount,
+            scalarMinMax * 1e6,
+            kernelMinMax * 1e6,
+            scalarMinMax / kernelMinMax,
+            scalarStacked * 1e6,
+            kernelStacked * 1e6,
+            scalarStacked / kernelStacked);
+    }
+    printf("\n");
+}
+
+// Per-call cost of reading each clock source.  GetPerfTimerCount() reads
+// whichever of the OS timer and the TSC PERF_TIMER_USE_TSC selects.
+void BenchmarkTimer()
+{
+#if defined(_WIN32)
+    auto osTimerName = "QueryPerformanceCounter";
+#elif defined(__APPLE__)
+    auto osTimerName = "mach_absolute_time";
+#else
+    auto osTimerName = "clock_gettime(MONOTONIC_RAW)";
+#endif
+
+    volatile uint64_t sink = 0;
+    auto osTime = MeasureCallTime([&]() { sink = GetOsPerfTimerCount(); });
+    auto perfTime = MeasureCallTime([&]() { sink = GetPerfTimerCount(); });
+    auto chronoTime = MeasureCallTime([&]() { sink = (uint64_t) std::chrono::steady_clock::now().time_since_epoch().count(); });
+
+    printf("Timer reads (nanoseconds per call)\n");
+    printf("%-32s %8.1f\n", osTimerName, osTime * 1e9);
+#ifdef PERF_TIMER_HAS_TSC
+    auto tscTime = MeasureCallTime([&]() { sink = GetTscPerfTimerCount(); });
+    printf("%-32s %8.1f    invariant: %s, calibrated at %.3f GHz\n",
+        "rdtsc",
+        tscTime * 1e9,
+        IsInvariantTscSupported() ? "yes" : "no",
+        (double) GetTscPerfTimerFrequency().Numerator / GetTscPerfTimerFrequency().Denominator * 1e-9);
+#endif
+    printf("%-32s %8.1f\n", "std::chrono::steady_clock", chronoTime * 1e9);
+#ifdef PERF_TIMER_USE_TSC
+    printf("%-32s %8.1f    (rdtsc)\n", "GetPerfTimerCount()", perfTime * 1e9);
+#else
+    printf("%-32s %8.1f    (%s)\n", "GetPerfTimerCount()", perfTime * 1e9, osTimerName);
+#endif
+    printf("\n");
+}
+
+// The time each thread spends entering and leaving a zone, from one thread
+// up to twice the number of hardware threads all timing the same zone, with
+// and without recording events for MetricsGuiTimeline.
+void BenchmarkZone()
+{
+    auto maxThreadCount = std::max(2 * std::thread::hardware_concurrency(), 2u);
+    auto& recordingEnabled = MetricsGuiZoneRecorder::GetRecordingEnabled();
+    auto wasRecording = recordingEnabled.load();
+
+    printf("Zone timers on N threads (nanoseconds per zone)\n");
+    printf("%8s %12s %12s\n", "threads", "zone", "recorded");
+    for (uint32_t threadCount = 1; threadCount <= maxThreadCount; threadCount *= 2) {
+        double zoneTime[2];
+        for (int recording = 0; recording < 2; ++recording) {
+            recordingEnabled.store(recording != 0);
+            MetricsGuiZone zone("Zone");
+            uint64_t zoneCount = 0;
+            auto zoneRate = MeasureCallRate(
+                threadCount,
+                [&]() { METRICS_GUI_ZONE(zone); },
+                [&]() { zone.Commit(); },
+                &zoneCount);
+            zoneTime[recording] = threadCount / zoneRate;
+        }
+        printf("%8u %12.1f %12.1f\n", threadCount, zoneTime[0] * 1e9, zoneTime[1] * 1e9);
+    }
+    printf("\n");
+    recordingEnabled.store(wasRecording);
+}
+
+struct Benchmark {
+    char const* mName;
+    void (*mRun)();
+};
+
+Benchmark const BENCHMARKS[] = {
+    { "counter", BenchmarkCounter },
+    { "reduce", BenchmarkReduce },
+    { "timer", BenchmarkTimer },
+    { "zone", BenchmarkZone },
+};
+
+} // anon namespace
+
+int main(
+    int argc,
+    char** argv)
+{
+    for (int i = 1; i < argc; ++i) {
+        auto found = false;
+        for (auto const& benchmark : BENCHMARKS) {
+            found = found || strcmp(argv[i], benchmark.mName) == 0;
+        }
+        if (!found) {
+            fprintf(stderr, "usage: benchmarks.exe [benchmark ...]\n");
+            fprintf(stderr, "benchmarks:\n");
+            for (auto const& benchmark : BENCHMARKS) {
+                fprintf(stderr, "    %s\n", benchmark.mName);
+            }
+            return 1;
+        }
+    }
+
+    for (auto const& benchmark : BENCHMARKS) {
+        auto run = argc == 1;
+        for (int i = 1; i < argc; ++i) {
+            run = run || strcmp(argv[i], benchmark.mName) == 0;
+        }
+        if (run) {
+            benchmark.mRun();
+        }
+    }
+    return 0;
+}
@@ -7,6 +7,10 @@ msbuild /p:configuration=debug "%~dp0sample\sample.sln"
 @if not "%errorlevel%"=="0" exit /b 1
 msbuild /p:configuration=release "%~dp0sample\sample.sln"
 @if not "%errorlevel%"=="0" exit /b 1
+"%~dp0sample\build\bin\debug\tests.exe"
+@if not "%errorlevel%"=="0" exit /b 1
+"%~dp0sample\build\bin\release\tests.exe"
+@if not "%errorlevel%"=="0" exit /b 1
 @echo.
 @echo.
 @echo PASS
@@ -0,0 +1,410 @@
+/*
+Copyright 2017 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+// Prints summary statistics for each metric in a capture file recorded by a
+// MetricsGuiCaptureWriter, without creating an ImGui context.  The capture is
+// read in a single pass over its chunks, and each metric uses a bounded
+// amount of memory however long the capture is.
+
+#include <metrics_gui/capture.h>
+#include <algorithm>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Counts values in logarithmic buckets keyed by the top 16 bits of their
+// magnitude's float representation (the exponent and 7 mantissa bits), so
+// percentiles are within 0.4% of the exact value.  Each sign only keeps
+// counts for the range of keys it has seen, which for most metrics spans a
+// few decades, i.e. a few thousand buckets.  Magnitudes below
+// MIN_MAGNITUDE_KEY (about 1e-12) are counted as zero.
+struct Distribution {
+    enum { MIN_MAGNITUDE_KEY = (127 - 40) << 7 };
+
+    // Counts of the contiguous range of keys from mFirstKey, grown as needed
+    struct KeyRange {
+        std::vector<uint64_t> mCounts;
+        uint32_t mFirstKey;
+
+        void Add(uint32_t key)
+        {
+            if (mCounts.empty()) {
+                mFirstKey = key;
+            } else if (key < mFirstKey) {
+                mCounts.insert(mCounts.begin(), mFirstKey - key, 0);
+                mFirstKey = key;
+            }
+            if (key - mFirstKey >= mCounts.size()) {
+                mCounts.resize(key - mFirstKey + 1, 0);
+            }
+            mCounts[key - mFirstKey] += 1;
+        }
+    };
+
+    KeyRange mNegative;
+    KeyRange mPositive;
+    uint64_t mZeroCount;
+    uint64_t mCount;
+    double mSum;
+    float mMin;
+    float mMax;
+
+    Distribution()
+        : mZeroCount(0)
+        , mCount(0)
+        , mSum(0.)
+        , mMin(INFINITY)
+        , mMax(-INFINITY)
+    {
+    }
+
+    void Add(float value)
+    {
+        if (value != value) {
+            return;
+        }
+        uint32_t bits = 0;
+        memcpy(&bits, &value, sizeof(bits));
+        auto key = (bits >> 16) & 0x7fffu;
+        if (key < MIN_MAGNITUDE_KEY) {
+            mZeroCount += 1;
+        } else {
+            (bits >> 31 == 0 ? mPositive : mNegative).Add(key);
+        }
+        mCount += 1;
+        mSum += value;
+        mMin = value < mMin ? value : mMin;
+        mMax = value > mMax ? value : mMax;
+    }
+
+    float GetBucketValue(uint32_t key, uint32_t signBit) const
+    {
+        auto bits = signBit | (key << 16) | 0x8000u;
+        float value = 0.f;
+        memcpy(&value, &bits, sizeof(value));
+        return value < mMin ? mMin : value > mMax ? mMax : value;
+    }
+
+    float GetPercentile(float percentile) const
+    {
+        // Visit buckets in value order: negative values from the largest
+        // magnitude down, then zero, then positive values from the smallest
+        // magnitude up.
+        auto rank = (uint64_t) ceil(percentile / 100. * (double) mCount);
+        rank = rank < 1 ? 1 : rank;
+        uint64_t count = 0;
+        for (auto i = mNegative.mCounts.size(); i-- > 0; ) {
+            count += mNegative.mCounts[i];
+            if (count >= rank) {
+                return GetBucketValue(mNegative.mFirstKey + (uint32_t) i, 0x80000000u);
+            }
+        }
+        count += mZeroCount;
+        if (count >= rank) {
+            return 0.f < mMin ? mMin : 0.f > mMax ? mMax : 0.f;
+        }
+        for (size_t i = 0, N = mPositive.mCounts.size(); i < N; ++i) {
+            count += mPositive.mCounts[i];
+            if (count >= rank) {
+                return GetBucketValue(mPositive.mFirstKey + (uint32_t) i, 0);
+            }
+        }
+        return mMax;
+    }
+};
+
+uint32_t const RECENT_FRAMES = 15;
+
+struct MetricSummary {
+    std::string mDescription;
+    std::string mUnits;
+    Distribution mValues;
+    bool mTimed;                            // Seconds, checked for stutters and against the budget
+    float mRecentValues[RECENT_FRAMES];     // Ring buffer of the last values, indexed by mValues.mCount
+    uint64_t mStutterCount;
+    uint64_t mOverBudgetCount;
+    double mOverBudgetTime;
+
+    MetricSummary(
+        std::string const& description,
+        std::string const& units)
+        : mDescription(description)
+        , mUnits(units)
+        , mTimed(units == "s")
+        , mStutterCount(0)
+        , mOverBudgetCount(0)
+        , mOverBudgetTime(0.)
+    {
+    }
+};
+
+struct Options {
+    char const* mPath;
+    double mBudget;
+    double mStutterFactor;
+    bool mJson;
+};
+
+float const PERCENTILES[] = { 50.f, 95.f, 99.f };
+
+// A stutter is a value more than stutterFactor times the median of the
+// previous RECENT_FRAMES values.  Unlike an average, the median doesn't lag
+// behind values that rise steadily, nor is it pulled up by a stutter.
+void AddValue(
+    MetricSummary* summary,
+    float value,
+    Options const& options)
+{
+    if (value != value) {
+        return;
+    }
+    if (summary->mTimed) {
+        auto recentCount = (uint32_t) std::min<uint64_t>(summary->mValues.mCount, RECENT_FRAMES);
+        if (recentCount > 0) {
+            float recent[RECENT_FRAMES];
+            std::copy(summary->mRecentValues, summary->mRecentValues + recentCount, recent);
+            std::nth_element(recent, recent + recentCount / 2, recent + recentCount);
+            if (value > options.mStutterFactor * recent[recentCount / 2]) {
+                summary->mStutterCount += 1;
+            }
+        }
+        if (value > options.mBudget) {
+            summary->mOverBudgetCount += 1;
+            summary->mOverBudgetTime += value - options.mBudget;
+        }
+        summary->mRecentValues[summary->mValues.mCount % RECENT_FRAMES] = value;
+    }
+    summary->mValues.Add(value);
+}
+
+void PrintJsonString(
+    std::string const& s)
+{
+    putchar('"');
+    for (auto c : s) {
+        if (c == '"' || c == '\\') {
+            printf("\\%c", c);
+        } else if ((unsigned char) c < 0x20) {
+            printf("\\u%04x", (unsigned) c);
+        } else {
+            putchar(c);
+        }
+    }
+    putchar('"');
+}
+
+void PrintJsonNumber(
+    double value)
+{
+    if (isfinite(value)) {
+        printf("%.9g", value);
+    } else {
+        printf("null");
+    }
+}
+
+void PrintJson(
+    Options const& options,
+    uint64_t frameCount,
+    uint64_t droppedFrameCount,
+    double duration,
+    std::vector<MetricSummary> const& summaries)
+{
+    printf("{\n  \"file\": ");
+    PrintJsonString(options.mPath);
+    printf(",\n  \"frames\": %llu,\n  \"droppedFrames\": %llu,\n  \"duration\": ", (unsigned long long) frameCount, (unsigned long long) droppedFrameCount);
+    PrintJsonNumber(duration);
+    printf(",\n  \"budget\": ");
+    PrintJsonNumber(options.mBudget);
+    printf(",\n  \"stutterFactor\": ");
+    PrintJsonNumber(options.mStutterFactor);
+    printf(",\n  \"metrics\": [");
+    for (size_t i = 0, N = summaries.size(); i < N; ++i) {
+        auto const& summary = summaries[i];
+        auto const& values = summary.mValues;
+        auto empty = values.mCount == 0;
+        printf("%s\n    { \"description\": ", i == 0 ? "" : ",");
+        PrintJsonString(summary.mDescription);
+        printf(", \"units\": ");
+        PrintJsonString(summary.mUnits);
+        printf(", \"count\": %llu, \"min\": ", (unsigned long long) values.mCount);
+        PrintJsonNumber(empty ? NAN : values.mMin);
+        printf(", \"avg\": ");
+        PrintJsonNumber(empty ? NAN : values.mSum / (double) values.mCount);
+        printf(", \"max\": ");
+        PrintJsonNumber(empty ? NAN : values.mMax);
+        for (auto percentile : PERCENTILES) {
+            printf(", \"p%g\": ", percentile);
+            PrintJsonNumber(empty ? NAN : values.GetPercentile(percentile));
+        }
+        if (summary.mTimed) {
+            printf(", \"stutters\": %llu, \"overBudgetFrames\": %llu, \"overBudgetTime\": ", (unsigned long long) summary.mStutterCount, (unsigned long long) summary.mOverBudgetCount);
+            PrintJsonNumber(summary.mOverBudgetTime);
+        }
+        printf(" }");
+    }
+    printf("\n  ]\n}\n");
+}
+
+void PrintText(
+    Options const& options,
+    uint64_t frameCount,
+    uint64_t droppedFrameCount,
+    double duration,
+    std::vector<MetricSummary> const& summaries)
+{
+    printf("%s: %llu frames (%llu dropped) over %.3f s\n", options.mPath, (unsigned long long) frameCount, (unsigned long long) droppedFrameCount, duration);
+    printf("budget %g s, stutters over %g x the recent median\n\n", options.mBudget, options.mStutterFactor);
+
+    int descriptionWidth = 6;
+    int unitsWidth = 5;
+    for (auto const& summary : summaries) {
+        descriptionWidth = std::max(descriptionWidth, (int) summary.mDescription.size());
+        unitsWidth = std::max(unitsWidth, (int) summary.mUnits.size());
+    }
+
+    printf("%-*s  %-*s  %11s  %11s  %11s  %11s  %11s  %11s  %9s  %11s  %11s\n", descriptionWidth, "metric", unitsWidth, "units",
+        "min", "avg", "max", "p50", "p95", "p99", "stutters", "over budget", "time over");
+    for (auto const& summary : summaries) {
+        auto const& values = summary.mValues;
+        printf("%-*s  %-*s", descriptionWidth, summary.mDescription.c_str(), unitsWidth, summary.mUnits.c_str());
+        if (values.mCount == 0) {
+            printf("  %11s  %11s  %11s  %11s  %11s  %11s", "-", "-", "-", "-", "-", "-");
+        } else {
+            printf("  %11.5g  %11.5g  %11.5g", values.mMin, values.mSum / (double) values.mCount, values.mMax);
+            for (auto percentile : PERCENTILES) {
+                printf("  %11.5g", values.GetPercentile(percentile));
+            }
+        }
+        if (summary.mTimed) {
+            printf("  %9llu  %11llu  %11.5g\n", (unsigned long long) summary.mStutterCount, (unsigned long long) summary.mOverBudgetCount, summary.mOverBudgetTime);
+        } else {
+            printf("  %9s  %11s  %11s\n", "-", "-", "-");
+        }
+    }
+}
+
+}
+
+int main(
+    int argc,
+    char** argv)
+{
+    // Parse command line
+    Options options = {};
+    options.mBudget = 1. / 60.;
+    options.mStutterFactor = 2.;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--json") == 0) {
+            options.mJson = true;
+            continue;
+        }
+
+        if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc) {
+            options.mBudget = strtod(argv[++i], nullptr);
+            continue;
+        }
+
+        if (strcmp(argv[i], "--stutter") == 0 && i + 1 < argc) {
+            options.mStutterFactor = strtod(argv[++i], nullptr);
+            continue;
+        }
+
+        if (argv[i][0] != '-' && options.mPath == nullptr) {
+            options.mPath = argv[i];
+            continue;
+        }
+
+        fprintf(stderr, "error: unrecognized argument '%s'\n", argv[i]);
+        options.mPath = nullptr;
+        break;
+    }
+
+    if (options.mPath == nullptr) {
+        fprintf(stderr, "usage: capture_analyzer.exe [options] capture.mgc\n");
+        fprintf(stderr, "options:\n");
+        fprintf(stderr, "    --json               print the summary as JSON\n");
+        fprintf(stderr, "    --budget seconds     frame time budget (default 1/60)\n");
+        fprintf(stderr, "    --stutter factor     stutter threshold relative to the recent median (default 2)\n");
+        return 1;
+    }
+
+    MetricsGuiCaptureReader reader;
+    if (!reader.Open(options.mPath)) {
+        fprintf(stderr, "error: could not read capture '%s'\n", options.mPath);
+        return 1;
+    }
+
+    // The first summary is of the time between captured frames, which is
+    // skipped across dropped frames.
+    auto secondsPerTick = (double) reader.mHeader.mTimerDenominator / (double) reader.mHeader.mTimerNumerator;
+    std::vector<MetricSummary> summaries;
+    summaries.reserve(reader.mMetrics.size() + 1);
+    summaries.emplace_back("Frame interval", "s");
+    for (auto const& metric : reader.mMetrics) {
+        summaries.emplace_back(metric.mDescription, metric.mUnits);
+    }
+
+    uint64_t frameCount = 0;
+    uint64_t prevFrameEnd = 0;
+    uint64_t prevTimestamp = 0;
+    for (size_t chunk = 0, chunkCount = reader.mChunks.size(); chunk < chunkCount; ++chunk) {
+        // Chunks found to be damaged count as dropped frames
+        auto const& entry = reader.mChunks[chunk];
+        auto timestamps = reader.GetTimestamps(chunk);
+        if (timestamps == nullptr) {
+            continue;
+        }
+        for (uint32_t i = 0; i < entry.mFrameCount; ++i) {
+            if (i > 0 || (frameCount > 0 && entry.mFirstFrame == prevFrameEnd)) {
+                AddValue(&summaries[0], (float) ((double) (timestamps[i] - prevTimestamp) * secondsPerTick), options);
+            }
+            prevTimestamp = timestamps[i];
+        }
+        for (uint32_t m = 0; m < reader.mHeader.mMetricCount; ++m) {
+            auto values = reader.GetValues(chunk, m);
+            auto summary = &summaries[m + 1];
+            for (uint32_t i = 0; i < entry.mFrameCount; ++i) {
+                AddValue(summary, values[i], options);
+            }
+        }
+        frameCount += entry.mFrameCount;
+        prevFrameEnd = entry.mFirstFrame + entry.mFrameCount;
+    }
+
+    auto droppedFrameCount = reader.GetFrameEnd() - frameCount;
+    auto duration = reader.mChunks.empty() ? 0. : (double) (reader.mChunks.back().mLastTimestamp - reader.mChunks.front().mFirstTimestamp) * secondsPerTick;
+    if (options.mJson) {
+        PrintJson(options, frameCount, droppedFrameCount, duration, summaries);
+    } else {
+        PrintText(options, frameCount, droppedFrameCount, duration, summaries);
+    }
+    return 0;
+}
@@ -0,0 +1,239 @@
+/*
+Copyright 2017 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef METRICS_GUI_CAPTURE_H
+#define METRICS_GUI_CAPTURE_H
+
+#include "metrics_gui.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A capture file records the values of a set of metrics once per frame.  It
+// starts with a MetricsGuiCaptureHeader, followed by a MetricsGuiCaptureMetric
+// and the description and units of each metric.  Frames follow in chunks,
+// each a MetricsGuiCaptureChunk followed by the chunk's frame timestamps and
+// then each metric's values in turn (i.e., one column per metric).  The
+// metric descriptions and chunks are zero-padded to a multiple of 8 bytes, so
+// a mapped file can be read in place.  A closed
+// capture ends with an index of its chunks, one MetricsGuiCaptureIndexEntry
+// each, followed by a MetricsGuiCaptureTrailer.  Values are stored in the
+// writing host's byte order, which is little-endian on all supported
+// platforms.
+
+struct MetricsGuiCaptureHeader {
+    enum { VERSION = 1 };
+
+    char mMagic[8];                         // "MGUICAP"
+    uint32_t mVersion;
+    uint32_t mMetricCount;
+    uint64_t mTimerNumerator;               // Timestamps tick mTimerNumerator / mTimerDenominator times per second
+    uint64_t mTimerDenominator;
+};
+
+struct MetricsGuiCaptureMetric {
+    uint32_t mFlags;
+    float mKnownMinValue;
+    float mKnownMaxValue;
+    uint16_t mDescriptionLength;            // Followed by the description then units, not null terminated
+    uint16_t mUnitsLength;
+};
+
+struct MetricsGuiCaptureChunk {
+    enum { MAGIC = 0x4b4e4843 };            // "CHNK"
+
+    uint32_t mMagic;
+    uint32_t mFrameCount;
+    uint64_t mFirstFrame;                   // Frame number of the chunk's first frame
+    uint64_t mFirstTimestamp;
+    uint64_t mLastTimestamp;
+
+    // Size of a chunk including its frames and padding.
+    static uint64_t GetSize(uint32_t frameCount, uint32_t metricCount)
+    {
+        auto valuesSize = (uint64_t) frameCount * metricCount * sizeof(float);
+        return sizeof(MetricsGuiCaptureChunk) + frameCount * sizeof(uint64_t) + ((valuesSize + 7) & ~7ull);
+    }
+};
+
+struct MetricsGuiCaptureIndexEntry {
+    uint64_t mOffset;                       // File offset of the MetricsGuiCaptureChunk
+    uint64_t mFirstFrame;
+    uint64_t mFirstTimestamp;
+    uint64_t mLastTimestamp;
+    uint32_t mFrameCount;
+    uint32_t mReserved;
+};
+
+struct MetricsGuiCaptureTrailer {
+    enum { MAGIC = 0x58444e49 };            // "INDX"
+
+    uint64_t mIndexOffset;                  // File offset of the first MetricsGuiCaptureIndexEntry
+    uint32_t mChunkCount;
+    uint32_t mMagic;
+};
+
+// Writes a capture file on a background thread.  RecordFrame() copies the
+// last value of each metric into the chunk being filled, and hands full
+// chunks to the writer thread, so the frame never waits on file I/O.  There
+// are two chunk buffers: if the writer thread is still writing one when the
+// other fills up, the frames in the full one are dropped and counted in
+// mDroppedFrameCount.  The time spent in each RecordFrame() is added to
+// mOverheadMetric, which can be plotted like any other metric.
+//
+// The metrics must outlive the capture, and RecordFrame() must be called on
+// the thread that adds values to them.
+struct MetricsGuiCaptureWriter {
+    enum { FRAMES_PER_CHUNK = 256 };
+
+    struct Buffer {
+        std::vector<uint64_t> mTimestamps;
+        std::vector<float> mValues;         // mFramesPerChunk values of each metric in turn
+        MetricsGuiCaptureChunk mChunk;
+        bool mFull;                         // Waiting for or being written by the writer thread
+    };
+
+    MetricsGuiMetric mOverheadMetric;
+    std::vector<MetricsGuiMetric const*> mMetrics;
+    Buffer mBuffers[2];
+    uint32_t mFillIndex;                    // Buffer being filled by RecordFrame()
+    uint32_t mWriteIndex;                   // Buffer the writer thread writes next
+    uint32_t mFramesPerChunk;
+    uint64_t mFrameCount;                   // Frames recorded or dropped
+    uint64_t mDroppedFrameCount;
+    std::vector<MetricsGuiCaptureIndexEntry> mIndex;    // Chunks written, owned by the writer thread until Close()
+    uint64_t mFileOffset;                   // Owned by the writer thread until Close()
+    std::atomic<bool> mWriteFailed;
+    FILE* mFile;
+    std::thread mThread;
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    bool mStop;
+
+    MetricsGuiCaptureWriter();
+    ~MetricsGuiCaptureWriter();
+
+    // Create the file and write the header.  Returns false if the file could
+    // not be written.
+    bool Open(char const* path, MetricsGuiMetric const* const* metrics, uint32_t metricCount, uint32_t framesPerChunk = FRAMES_PER_CHUNK);
+
+    // Record the last value of each metric, with the current
+    // GetPerfTimerCount() or timestamp if specified.
+    void RecordFrame();
+    void RecordFrame(uint64_t timestamp);
+
+    // Write the remaining frames and the chunk index, and close the file.
+    // Returns false if any write failed.
+    bool Close();
+    bool IsOpen() const { return mFile != nullptr; }
+
+    MetricsGuiCaptureWriter(MetricsGuiCaptureWriter const&) = delete;
+    MetricsGuiCaptureWriter& operator=(MetricsGuiCaptureWriter const&) = delete;
+};
+
+// Reads a capture file by mapping it into memory, so only the pages of the
+// chunks that are read are loaded.  The chunk index is read from the end of
+// the file, or rebuilt by walking the chunk headers if the capture was not
+// closed, and chunks are found by frame or timestamp with a binary search.
+// The reader does not depend on ImGui, except for Replay() and
+// InitializeMetric() which are defined with the writer.
+struct MetricsGuiCaptureReader {
+    enum ChunkState {
+        CHUNK_UNCHECKED,
+        CHUNK_VALID,
+        CHUNK_INVALID,                      // The chunk header doesn't match its index entry
+    };
+
+    struct Metric {
+        std::string mDescription;
+        std::string mUnits;
+        uint32_t mFlags;
+        float mKnownMinValue;
+        float mKnownMaxValue;
+    };
+
+    MetricsGuiCaptureHeader mHeader;
+    std::vector<Metric> mMetrics;
+    std::vector<MetricsGuiCaptureIndexEntry> mChunks;
+    mutable std::vector<uint8_t> mChunkStates;  // ChunkState of each chunk, checked on first read
+    uint8_t const* mData;
+    uint64_t mSize;
+#if defined(_WIN32)
+    void* mFile;
+    void* mMapping;
+#else
+    int mFile;
+#endif
+
+    MetricsGuiCaptureReader();
+    ~MetricsGuiCaptureReader();
+
+    // Returns false if the file can't be mapped or is not a capture.
+    bool Open(char const* path);
+    void Close();
+    bool IsOpen() const { return mData != nullptr; }
+
+    // Frames are numbered from the start of the capture, and dropped frames
+    // leave gaps between chunks.
+    uint64_t GetFrameEnd() const;
+
+    // Index of the first chunk holding frames at or after frame (or
+    // timestamp), or mChunks.size() if there is none.
+    size_t FindChunkByFrame(uint64_t frame) const;
+    size_t FindChunkByTimestamp(uint64_t timestamp) const;
+
+    // Pointers into the mapped file, with mChunks[chunk].mFrameCount elements.
+    // Open() only checks that the index entries are within the file, so
+    // that opening a large capture doesn't read all of it; each chunk's
+    // header is checked against its entry when the chunk is first read.
+    // These return nullptr for a chunk whose header doesn't match, which
+    // callers should treat as dropped frames.  Not thread safe, as they
+    // update mChunkStates.
+    bool IsChunkValid(size_t chunk) const;
+    uint64_t const* GetTimestamps(size_t chunk) const;
+    float const* GetValues(size_t chunk, uint32_t metricIndex) const;
+
+    // Initialize metric with the description, units, flags and known range of
+    // a captured metric.
+    void InitializeMetric(uint32_t metricIndex, MetricsGuiMetric* metric, uint32_t historySize = MetricsGuiMetric::NUM_HISTORY_SAMPLES) const;
+
+    // Replace the histories of metrics with the captured values of frames
+    // [beginFrame, endFrame).  metrics[i] receives the values of captured
+    // metric i, or is skipped if nullptr.  Each metric's history is cleared
+    // with ClearHistory() first, so a window can be replayed after a later
+    // one.  Timestamps are shifted to the replay clock: the last replayed
+    // frame is timestamped with the current GetPerfTimerCount(), and earlier
+    // frames keep their captured spacing, so plots with mTimeWindow show the
+    // replayed window.  Chunks that are not valid are skipped.
+    void Replay(uint64_t beginFrame, uint64_t endFrame, MetricsGuiMetric* const* metrics) const;
+
+    MetricsGuiCaptureReader(MetricsGuiCaptureReader const&) = delete;
+    MetricsGuiCaptureReader& operator=(MetricsGuiCaptureReader const&) = delete;
+};
+
+#endif // ifndef METRICS_GUI_CAPTURE_H
@@ -22,43 +22,376 @@ SOFTWARE.
 #ifndef METRICS_GUI_H
 #define METRICS_GUI_H
 
+#include <atomic>
+#include <stddef.h>
 #include <stdint.h>
-#include <string>
 #include <vector>
 
+// A read-only view of a metric's history.  The history is stored in a ring
+// buffer, so the view consists of up to two contiguous spans which together
+// hold the samples ordered from oldest to newest.
+struct MetricsGuiHistoryView {
+    float const* mSpan[2];
+    uint32_t mSpanCount[2];
+
+    uint32_t Size() const { return mSpanCount[0] + mSpanCount[1]; }
+    float operator[](uint32_t i) const { return i < mSpanCount[0] ? mSpan[0][i] : mSpan[1][i - mSpanCount[0]]; }
+};
+
+// A monotonic queue of history indices, used to track the minimum or
+// maximum of the history incrementally.  mIndices is a ring buffer with the
+// same size as the history.
+struct MetricsGuiExtremeQueue {
+    uint32_t* mIndices;
+    uint32_t mHead;
+    uint32_t mCount;
+};
+
+// Counts of history values falling into value bins.  Bin edges are spaced
+// linearly, logarithmically, or on a 1-2-5 sequence of each power of ten
+// (SI_DECADES) which suits SI-prefixed units like seconds.  Values outside
+// of the range are counted in the first or last bin.
+struct MetricsGuiHistogram {
+    enum Scale {
+        LINEAR,
+        LOGARITHMIC,
+        SI_DECADES,
+    };
+
+    std::vector<uint32_t> mCounts;
+    std::vector<float> mEdges;              // mCounts.size() + 1 bin edges, ascending
+    uint32_t mScale;
+
+    void Initialize(uint32_t binCount, float minValue, float maxValue, Scale scale);
+    uint32_t GetBin(float value) const;
+};
+
+// Minimum, maximum, sum and count of a run of consecutive history values.
+struct MetricsGuiAggregate {
+    float mMin;
+    float mMax;
+    float mSum;
+    uint32_t mCount;
+};
+
+// One tier of a metric's downsampled history.  Each bucket aggregates
+// mSamplesPerBucket consecutive values.  Completed buckets are stored in a
+// ring buffer, and the bucket being filled is kept in mPending.
+struct MetricsGuiHistoryTier {
+    std::vector<MetricsGuiAggregate> mBuckets;  // Ring buffer
+    MetricsGuiAggregate mPending;               // Partially filled bucket, newer than all of mBuckets
+    uint32_t mSamplesPerBucket;
+    uint32_t mBucketHead;                       // Index of the oldest bucket, where the next bucket will be written
+    uint32_t mBucketCount;                      // Number of completed buckets in mBuckets
+
+    // i==0 is the oldest completed bucket, i==mBucketCount is mPending.
+    MetricsGuiAggregate const& GetBucket(uint32_t i) const;
+};
+
+// Values that have left a metric's history, compressed in blocks of
+// mValuesPerBlock values.  As in Gorilla (Pelkonen et al., 2015), each value
+// is XORed with the previous one and only the bits that differ are stored,
+// inside the window of the previous XOR when possible.  Runs of repeated
+// values are stored as a count.  Slowly changing values take a few bits
+// each, and constant stretches a few bits per run.  Blocks are encoded as
+// values arrive and decoded only when read, and the oldest block is dropped
+// when all blocks are full.
+struct MetricsGuiHistoryArchive {
+    struct Block {
+        std::vector<uint64_t> mBits;
+        uint64_t mBitCount;
+        MetricsGuiAggregate mAggregate;     // Of the values in the block
+        mutable std::vector<MetricsGuiAggregate> mRuns; // Of each run of mValuesPerRun values, once the block is full and has been read
+    };
+
+    std::vector<Block> mBlocks;             // Ring buffer, the newest block is being filled
+    uint32_t mValuesPerBlock;
+    uint32_t mBlockHead;                    // Index of the oldest block
+    uint32_t mBlockCount;                   // Number of blocks holding values
+    mutable uint32_t mValuesPerRun;         // Run length of the cached Block::mRuns
+
+    // Encoder state of the newest block
+    uint32_t mPrevValueBits;
+    uint32_t mLeadingZeros;                 // Window of the previous XOR
+    uint32_t mMeaningfulBits;
+    uint32_t mRunLength;                    // Repeats of mPrevValueBits not yet stored
+
+    void Initialize(uint32_t valuesPerBlock, uint32_t blockCount);
+    void AddValue(float value);
+
+    // Values are indexed from oldest to newest.  GetValues() decodes only
+    // the blocks overlapping [begin, end), and GetBlockAggregate() merges
+    // their aggregates without decoding them.
+    //
+    // GetRunAggregates() aggregates the runs of valuesPerRun values that
+    // overlap [begin, end), which start at multiples of valuesPerRun and may
+    // include values outside [begin, end), and returns their number.
+    // GetValuesPerRun() returns the smallest run length of at least
+    // minValuesPerRun that divides mValuesPerBlock or is a multiple of it,
+    // so runs tile the blocks: runs of a block or more merge block
+    // aggregates, and shorter runs are cached for full blocks, so plots
+    // redrawn as values arrive only decode the newest block again.  Blocks
+    // outside the runs read drop their cached runs, which keeps the cache to
+    // about one aggregate per run read; GetMemorySize() includes it.
+    uint32_t GetValueCount() const;
+    void GetValues(uint32_t begin, uint32_t end, float* dst) const;
+    MetricsGuiAggregate GetBlockAggregate(uint32_t begin, uint32_t end) const;
+    uint32_t GetValuesPerRun(uint32_t minValuesPerRun) const;
+    uint32_t GetRunAggregates(uint32_t begin, uint32_t end, uint32_t valuesPerRun, MetricsGuiAggregate* dst) const;
+    size_t GetMemorySize() const;
+};
+
+struct MetricsGuiStagingQueue;
+struct MetricsGuiPlotGeometry;
+struct MetricsGuiFrameArena;
+struct MetricsGuiExtremeTree;
+
 struct MetricsGuiMetric {
     enum Flags {
         NONE                    = 0,
         USE_SI_UNIT_PREFIX      = 1u << 1,
         KNOWN_MIN_VALUE         = 1u << 2,
         KNOWN_MAX_VALUE         = 1u << 3,
+        TRACK_PERCENTILES       = 1u << 4,  // maintain a sorted copy of the history for GetPercentileValue()
+        TRACK_TIMESTAMPS        = 1u << 5,  // record when each value was added, for plots with mTimeWindow
+        HISTORY_FLOAT16         = 1u << 6,  // store the history as 16-bit floats
+        HISTORY_UNORM16         = 1u << 7,  // store the history as 16-bit fractions of [mKnownMinValue, mKnownMaxValue]
+        HISTORY_UNORM8          = 1u << 8,  // store the history as 8-bit fractions of [mKnownMinValue, mKnownMaxValue]
+        HISTORY_FORMAT_MASK     = HISTORY_FLOAT16 | HISTORY_UNORM16 | HISTORY_UNORM8,
     };
 
-    enum { NUM_HISTORY_SAMPLES = 256 };
+    enum { NUM_HISTORY_SAMPLES = 256 };    // default history size
 
-    std::string mDescription;
-    std::string mUnits;
-    double mTotalInHistory; // needs to be double for precision reasons (accumulating small deltas)
+    // Fields used by AddNewValue() and MetricsGuiPlot::UpdateAxes() come
+    // first, ahead of the fields that are only read when drawing labels or
+    // with optional features.  The scalars updated with every value are held
+    // inline in the metric's first 40 bytes, next to the history pointer.
+    union {
+        float* mHistory;                    // Ring buffer.  Don't forget to update mTotalInHistory and mGeneration if you modify this outside of AddNewValue()
+        uint16_t* mHistory16;               // mHistory if HISTORY_FLOAT16 or HISTORY_UNORM16
+        uint8_t* mHistory8;                 // mHistory if HISTORY_UNORM8
+    };
+    uint32_t mHistorySize;                  // Number of values in mHistory
+    uint32_t mHistoryHead;                  // Index of the oldest value in mHistory, where the next value will be written
     uint32_t mHistoryCount;
-    float mColor[4];
-    float mHistory[NUM_HISTORY_SAMPLES];    // Don't forget to update mTotalInHistory if you modify this outside of AddNewValue()
-    float mKnownMinValue;
-    float mKnownMaxValue;
     uint32_t mFlags;
+    double mTotalInHistory; // needs to be double for precision reasons (accumulating small deltas)
+    mutable float mHistoryMinValue;         // Valid unless mExtremesDirty, see GetHistoryMinValue()
+    mutable float mHistoryMaxValue;
+    mutable MetricsGuiExtremeQueue mMinQueue;   // Indices of values smaller than all newer values, oldest first
+    mutable MetricsGuiExtremeQueue mMaxQueue;   // Indices of values larger than all newer values, oldest first
+    mutable bool mExtremesDirty;                // Queues need to be rebuilt before use
     bool mSelected;
+    float mKnownMinValue;
+    float mKnownMaxValue;
+    uint32_t mGeneration;                   // Incremented when the history changes, so plots can reuse their geometry
+
+    // Previously std::string.  Strings assigned directly should come from
+    // MetricsGuiRegistry::Intern(), as plots and timelines may use them
+    // after the metric is destroyed.
+    char const* mDescription;               // Interned, see MetricsGuiRegistry::Intern()
+    char const* mUnits;                     // Interned
+    float mColor[4];
+    float* mSortedHistory;                  // The mHistoryCount most recent values in ascending order, if TRACK_PERCENTILES
+    uint64_t* mTimestamps;                  // Ring buffer of GetPerfTimerCount() for each value in mHistory, if TRACK_TIMESTAMPS
+    MetricsGuiHistogram mHistogram;         // Distribution of the mHistoryCount most recent values, see EnableHistogram()
+    std::vector<MetricsGuiHistoryTier> mTiers;  // Downsampled history, finest first, see EnableHistoryTiers()
+    MetricsGuiStagingQueue* mStagingQueue;  // Values pushed from other threads, see EnableStaging()
+    MetricsGuiHistoryArchive* mArchive;     // Values older than the history, see EnableHistoryArchive()
+    mutable MetricsGuiExtremeTree* mExtremeTree;    // Extremes of blocks of the history, see GetHistoryRangeExtremes()
 
+    // historySize is the number of values kept in the metric's history.  The
+    // history storage is allocated from a pool shared by all metrics, which
+    // packs histories of the same size class next to each other.
+    //
+    // The HISTORY_* flags store the history in 2 or 1 bytes per value instead
+    // of 4.  Values are rounded to the storage format when added, so the
+    // average, extremes and percentiles all see the stored values.  For the
+    // UNORM formats, values are clamped to [mKnownMinValue, mKnownMaxValue],
+    // which must be set before values are added and not changed afterwards.
     MetricsGuiMetric();
-    MetricsGuiMetric(char const* description, char const* units, uint32_t flags);
-    void Initialize(char const* description, char const* units, uint32_t flags);
+    MetricsGuiMetric(char const* description, char const* units, uint32_t flags, uint32_t historySize = NUM_HISTORY_SAMPLES);
+    MetricsGuiMetric(MetricsGuiMetric const& copy);
+    ~MetricsGuiMetric();
+    MetricsGuiMetric& operator=(MetricsGuiMetric const& copy);
+    void Initialize(char const* description, char const* units, uint32_t flags, uint32_t historySize = NUM_HISTORY_SAMPLES);
 
+    // If TRACK_TIMESTAMPS, AddNewValue() records the current
+    // GetPerfTimerCount() with the value, or timestamp if specified.
+    // Timestamps must not decrease.
     void AddNewValue(float value);
+    void AddNewValue(float value, uint64_t timestamp);
     float GetAverageValue() const;
 
+    // Get the minimum and maximum of the mHistoryCount values added to the
+    // history, or 0 if there are none.  These are maintained incrementally
+    // by AddNewValue(), so cost O(1).  After SetLastValue() they are
+    // recomputed on the next call.
+    float GetHistoryMinValue() const;
+    float GetHistoryMaxValue() const;
+    void UpdateExtremes() const;
+
+    // Get the minimum and maximum of history values [begin, end), ordered
+    // from oldest to newest.  The first call builds a tree of the extremes
+    // of blocks of the history in O(mHistorySize) time, which AddNewValue()
+    // and SetLastValue() then keep up to date, so later calls cost
+    // O(log mHistorySize).
+    void GetHistoryRangeExtremes(uint32_t begin, uint32_t end, float* minValue, float* maxValue) const;
+
+    // Get order statistics of the most recent mHistoryCount values.  The
+    // metric must have been initialized with TRACK_PERCENTILES, in which case
+    // a sorted copy of the history is updated by AddNewValue() and
+    // SetLastValue() in O(mHistorySize) worst case, and queries are O(1).
+    //
+    // GetPercentileValue() interpolates between the closest ranks, with
+    // percentile in [0, 100].  GetTailAverageValue() returns the average of
+    // the values at or above percentile; e.g., 1.f / GetTailAverageValue(99.f)
+    // of a frame time metric is the "1% low" frame rate.
+    float GetPercentileValue(float percentile) const;
+    float GetTailAverageValue(float percentile) const;
+
+    // Bin the most recent mHistoryCount values into a histogram, which is
+    // drawn by MetricsGuiPlot::DrawHistogram().  Bin counts are updated
+    // incrementally as values enter and leave the history.  For SI_DECADES,
+    // binCount is ignored and bins are created for each 1-2-5 step in the
+    // range.
+    void EnableHistogram(uint32_t binCount, float minValue, float maxValue, MetricsGuiHistogram::Scale scale = MetricsGuiHistogram::LINEAR);
+
+    // Keep a downsampled history that reaches further back than mHistorySize
+    // values.  Tier i stores bucketCount aggregates of samplesPerBucket[i]
+    // consecutive values, each a multiple of the previous tier's; e.g.,
+    // { 240, 2400, 14400 } for a metric added at 240 Hz gives 1 s, 10 s and
+    // 1 min buckets.  AddNewValue() rolls values up into the tiers in O(1)
+    // amortized time, and history plots longer than mHistorySize draw from
+    // the tier that best matches their width.  SetLastValue() does not
+    // update the tiers.
+    void EnableHistoryTiers(uint32_t const* samplesPerBucket, uint32_t tierCount, uint32_t bucketCount = NUM_HISTORY_SAMPLES);
+
+    // Keep at least valueCount values that have left the history, compressed
+    // in blocks of valuesPerBlock (see MetricsGuiHistoryArchive).  History
+    // plots longer than mHistorySize draw the archived values themselves if
+    // the plot is at least as many pixels wide as the values it spans, or
+    // aggregates of about a pixel's worth of them if the metric has no
+    // tiers.  SetLastValue() does not update the archive.
+    void EnableHistoryArchive(uint32_t valueCount, uint32_t valuesPerBlock = 1024);
+
+    // Remove all values from the history, and from the histogram, tiers and
+    // archive, keeping the metric's flags, known range and the options they
+    // were enabled with.
+    void ClearHistory();
+
     // Get and set values in the history buffer.  prevIndex==0 gets/sets last
-    // value added, prevIndex==NUM_HISTORY_SAMPLES-1 gets/sets the oldest
+    // value added, prevIndex==mHistorySize-1 gets/sets the oldest
     // stored value.
     void SetLastValue(float value, uint32_t prevIndex = 0);
     float GetLastValue(uint32_t prevIndex = 0) const;
+
+    // Get the history ordered from oldest to newest value.  With a HISTORY_*
+    // flag, the view refers to a decoded copy that is only valid until the
+    // next GetHistory() call on the same thread.
+    MetricsGuiHistoryView GetHistory() const;
+
+    // Get the index, ordered from oldest to newest value, of the oldest value
+    // added at or after timestamp, using a binary search of mTimestamps.
+    // Returns mHistorySize if there is none.  Indices of values not yet
+    // added (i.e., below mHistorySize - mHistoryCount) are never returned.
+    uint32_t FindHistoryIndex(uint64_t timestamp) const;
+    uint64_t GetTimestamp(uint32_t index) const;
+
+    // AddNewValue() must be called on the thread that draws the metric.  To
+    // produce values on other threads, enable staging and use PushValue()
+    // instead.  PushValue() can be called from any number of threads; it is
+    // lock free and never blocks, and if the staging queue is full the value
+    // is dropped and counted.  Staged values are moved into the history by
+    // DrainStagedValues(), which MetricsGuiPlot::UpdateAxes() calls for each
+    // of its metrics.  With TRACK_TIMESTAMPS, values are timestamped when
+    // they are pushed rather than when they are drained.
+    void EnableStaging(uint32_t queueSize = NUM_HISTORY_SAMPLES);
+    bool PushValue(float value);
+    uint32_t DrainStagedValues();
+    uint64_t GetDroppedValueCount() const;
+};
+
+// A metric that counts events occurring on any number of threads.  Each
+// thread increments its own cache-line sized shard, so threads do not
+// contend with each other.  Once per frame, Collect() sums and resets the
+// shards and adds the total to the history with AddNewValue().
+struct MetricsGuiCounter : public MetricsGuiMetric {
+    enum { NUM_SHARDS = 64 };
+
+    struct Shard {
+        std::atomic<uint64_t> mCount;
+        char mPad[64 - sizeof(std::atomic<uint64_t>)];
+    };
+
+    void* mShardMemory;
+    Shard* mShards;
+    uint32_t mShardCount;
+
+    MetricsGuiCounter(char const* description, char const* units, uint32_t flags, uint32_t historySize = NUM_HISTORY_SAMPLES, uint32_t shardCount = NUM_SHARDS);
+    ~MetricsGuiCounter();
+
+    void Increment(uint64_t count = 1)
+    {
+        mShards[GetThreadShardIndex() % mShardCount].mCount.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    uint64_t Collect();
+
+    static uint32_t GetThreadShardIndex();
+
+    MetricsGuiCounter(MetricsGuiCounter const&) = delete;
+    MetricsGuiCounter& operator=(MetricsGuiCounter const&) = delete;
+};
+
+// Finds metrics by description, using an open-addressing hash table.  The
+// metric pointers returned are stable for the life of the registry, so hot
+// paths can look a metric up once and keep the pointer.  Metrics created by
+// AddMetric() are stored contiguously in blocks of METRICS_PER_BLOCK.  A
+// registry must only be used from one thread at a time.
+//
+// Metric descriptions and units are interned, i.e. stored once for the
+// life of the process and shared by all metrics using the same string.
+// Intern() can be called from any thread.
+struct MetricsGuiRegistry {
+    enum { METRICS_PER_BLOCK = 64 };
+
+    struct Slot {
+        MetricsGuiMetric* mMetric;          // nullptr if the slot is empty
+        uint32_t mHash;
+    };
+
+    std::vector<Slot> mSlots;               // Power-of-two size, linear probing
+    std::vector<MetricsGuiMetric*> mMetrics;    // Registered metrics, in registration order
+    std::vector<MetricsGuiMetric*> mBlocks;     // Storage for metrics created by AddMetric()
+    uint32_t mOwnedCount;
+
+    MetricsGuiRegistry();
+    ~MetricsGuiRegistry();
+
+    // Create a metric owned by the registry, or return the registered metric
+    // with the same description.
+    MetricsGuiMetric* AddMetric(char const* description, char const* units, uint32_t flags, uint32_t historySize = MetricsGuiMetric::NUM_HISTORY_SAMPLES);
+
+    // Register a metric owned by the caller.  Returns false if a metric with
+    // the same description is already registered, whether or not the
+    // descriptions are interned.  A registered metric must
+    // not be re-initialized with a different description.
+    //
+    // The registry only keeps a pointer to the metric, so a metric that is
+    // destroyed or moved before the registry must first be unregistered.
+    // UnregisterMetric() returns false if the metric is not registered.
+    bool RegisterMetric(MetricsGuiMetric* metric);
+    bool UnregisterMetric(MetricsGuiMetric* metric);
+
+    // Returns nullptr if no metric with the description is registered.
+    MetricsGuiMetric* FindMetric(char const* description) const;
+
+    static char const* Intern(char const* s);
+    static uint32_t Hash(char const* s);
+
+    MetricsGuiRegistry(MetricsGuiRegistry const&) = delete;
+    MetricsGuiRegistry& operator=(MetricsGuiRegistry const&) = delete;
 };
 
 struct MetricsGuiPlot {
@@ -75,9 +408,17 @@ struct MetricsGuiPlot {
     std::vector<MetricsGuiMetric*> mMetrics;
     std::vector<std::pair<float, float> > mMetricRange;
     WidthInfo* mWidthInfo;
+    MetricsGuiPlotGeometry* mGeometry;      // Series drawn by the last DrawHistory(), reused until they change
+    MetricsGuiFrameArena* mFrameArena;      // Temporaries of the plot's draw calls
     float mMinValue;
     float mMaxValue;
     bool mRangeInitialized;
+    std::vector<uint32_t> mAxesKey;         // Metrics, their mGeneration and the options mMetricTargetRange was computed from
+    std::vector<std::pair<float, float> > mMetricTargetRange;  // Undampened range of each metric
+    float mTargetMinValue;                  // Undampened axis range
+    float mTargetMaxValue;
+    uint32_t mPlotWidth;                    // Width in pixels of the last plot drawn, 0 before the first
+    float mPlotHeight;                      // Height in pixels of the last DrawHistory() plot, 0 before the first
 
     // Draw/update options:
     float mBarRounding;             // amount of rounding on bars
@@ -86,19 +427,26 @@ struct MetricsGuiPlot {
     uint32_t mPlotRowCount;         // height of DrawHistory() plots, in text rows
     uint32_t mVBarMinWidth;         // min width of bar graph bar in pixels
     uint32_t mVBarGapWidth;         // width of bar graph inter-bar gap in pixels
+    uint32_t mHistoryLength;        // number of most recent values spanned by history plots, 0 for the largest metric history
+    float mTimeWindow;              // seconds spanned by history plots of TRACK_TIMESTAMPS metrics, 0 to plot by value
+    std::vector<float> mPercentiles;    // percentiles shown by mShowPercentiles and mShowLegendPercentiles
     bool mShowAverage;              // draw horizontal line at series average
+    bool mShowPercentiles;          // draw horizontal lines at series percentiles (TRACK_PERCENTILES metrics only)
     bool mShowInlineGraphs;         // show history plot in DrawList()
     bool mShowOnlyIfSelected;       // draw show selected metrics
     bool mShowLegendDesc;           // show series description in legend
     bool mShowLegendColor;          // use series color in legend
     bool mShowLegendUnits;          // show units in legend values
     bool mShowLegendAverage;        // show series average in legend
+    bool mShowLegendPercentiles;    // show series percentiles in legend (TRACK_PERCENTILES metrics only)
     bool mShowLegendMin;            // show plot y-axis minimum in legend
     bool mShowLegendMax;            // show plot y-axis maximum in legend
     bool mBarGraph;                 // use bars to draw history
     bool mStacked;                  // stack series when drawing history
     bool mSharedAxis;               // use first series' axis range
     bool mFilterHistory;            // allow single plot point to represent more than on history value
+    bool mThinLines;                // draw history lines one pixel wide without anti-aliasing
+    bool mFilterMinMax;             // with mFilterHistory, draw the range of the values each point represents rather than their average
 
     MetricsGuiPlot();
     MetricsGuiPlot(MetricsGuiPlot const& copy);
@@ -113,6 +461,7 @@ struct MetricsGuiPlot {
     void LinkLegends(MetricsGuiPlot* plot);
 
     void UpdateAxes();
+    void UpdateTargetRanges();
 
     // -----------------------------------------------------------------
     // | description | padding | bar........ | padding | quanity units |
@@ -129,6 +478,15 @@ struct MetricsGuiPlot {
     // | ........................................| Min: quantity units |
     // -----------------------------------------------------------------
     void DrawHistory();
+
+    // Draws the histograms of metrics with EnableHistogram(), with value bins
+    // along the x-axis and bin counts along the y-axis.
+    // -----------------------------------------------------------------
+    // | bins....................................| Description         |
+    // | ........................................| Hi: quantity units  |
+    // | ........................................| Lo: quantity units  |
+    // -----------------------------------------------------------------
+    void DrawHistogram();
 };
 
 #endif // ifndef METRICS_GUI_H
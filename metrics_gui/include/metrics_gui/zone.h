@@ -0,0 +1,333 @@
+/*
+Copyright 2017 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef METRICS_GUI_ZONE_H
+#define METRICS_GUI_ZONE_H
+
+#include "metrics_gui.h"
+#include "../../../portable/perf_timer.h"
+
+#include <atomic>
+#include <stdint.h>
+#include <vector>
+
+struct MetricsGuiZoneTimer;
+
+// The zone timing state of a thread, kept together so that a zone timer
+// reads it with a single thread-local access.
+struct MetricsGuiZoneThread {
+    static uint32_t const NO_SHARD = UINT32_MAX;
+
+    MetricsGuiZoneTimer* mTimer;            // Innermost running timer
+    uint32_t mShardIndex;                   // NO_SHARD until the thread's first zone timer ends
+
+    static MetricsGuiZoneThread& Get()
+    {
+        static thread_local MetricsGuiZoneThread thread = { nullptr, NO_SHARD };
+        return thread;
+    }
+
+    // Returns a shard index that no other running thread holds.  The index
+    // is released when the thread exits, for reuse by later threads.
+    static uint32_t AcquireShardIndex();
+};
+
+// A metric that accumulates the time spent in MetricsGuiZoneTimer scopes on
+// any number of threads.  Once per frame, Commit() adds the time accumulated
+// since the last Commit() to the history, in seconds.  The time spent in the
+// zone excluding nested zones (its self time) is added to mSelfMetric, which
+// can be plotted like any other metric.
+//
+// Each thread accumulates into its own cache-line sized shard, so threads
+// timing the same zone do not contend.  A shard is only written by the
+// thread holding its index, so it is updated with plain relaxed loads and
+// stores rather than atomic read-modify-writes, and is never reset; Commit()
+// takes the difference from the totals it saw last.  Threads beyond the
+// first mShardCount share one more shard, which they update with fetch_add.
+struct MetricsGuiZone : public MetricsGuiMetric {
+    struct Shard {
+        std::atomic<uint64_t> mTicks;
+        std::atomic<uint64_t> mSelfTicks;
+        char mPad[64 - 2 * sizeof(std::atomic<uint64_t>)];
+    };
+
+    MetricsGuiMetric mSelfMetric;
+    std::atomic<uint32_t> mPackedColor;     // mColor as recorded with timeline events, updated by Commit()
+    void* mShardMemory;
+    Shard* mShards;                         // mShardCount + 1 shards
+    uint32_t mShardCount;
+    double mSecondsPerTick;
+    uint64_t mCommittedTicks;               // Sums of the shards at the last Commit()
+    uint64_t mCommittedSelfTicks;
+
+    MetricsGuiZone(char const* description, uint32_t flags = USE_SI_UNIT_PREFIX, uint32_t historySize = NUM_HISTORY_SAMPLES, uint32_t shardCount = MetricsGuiCounter::NUM_SHARDS);
+    ~MetricsGuiZone();
+
+    void AddTicks(MetricsGuiZoneThread* thread, uint64_t ticks, uint64_t selfTicks)
+    {
+        auto index = thread->mShardIndex;
+        if (index == MetricsGuiZoneThread::NO_SHARD) {
+            index = MetricsGuiZoneThread::AcquireShardIndex();
+            thread->mShardIndex = index;
+        }
+        if (index < mShardCount) {
+            auto& shard = mShards[index];
+            shard.mTicks.store(shard.mTicks.load(std::memory_order_relaxed) + ticks, std::memory_order_relaxed);
+            shard.mSelfTicks.store(shard.mSelfTicks.load(std::memory_order_relaxed) + selfTicks, std::memory_order_relaxed);
+        } else {
+            auto& shard = mShards[mShardCount];
+            shard.mTicks.fetch_add(ticks, std::memory_order_relaxed);
+            shard.mSelfTicks.fetch_add(selfTicks, std::memory_order_relaxed);
+        }
+    }
+
+    void Commit();
+
+    MetricsGuiZone(MetricsGuiZone const&) = delete;
+    MetricsGuiZone& operator=(MetricsGuiZone const&) = delete;
+};
+
+// A zone timer's interval, recorded for MetricsGuiTimeline.  Events keep
+// the zone's interned description and color rather than the zone itself,
+// so a zone can be destroyed while its events are still drawn.
+struct MetricsGuiZoneEvent {
+    char const* mDescription;
+    uint64_t mBeginTicks;
+    uint64_t mEndTicks;
+    uint32_t mDepth;            // Number of enclosing zone timers on the thread
+    uint32_t mColor;            // MetricsGuiZone::mPackedColor
+};
+
+// The zone events of one thread, in the order their timers ended.  The
+// owning thread writes them into a ring buffer while other threads read
+// them, so the events are stored as relaxed atomics.  mClaimCount is
+// incremented before an event is written and mWriteCount after, so a
+// reader can tell which of the events it read may have been overwritten.
+//
+// The ring buffer starts with MIN_EVENTS events, and doubles in size, up to
+// MAX_EVENTS, whenever an event is about to be overwritten before the
+// timeline is done with it: that is, if it ended after the start of the
+// frame selected for drawing.  A reader may still be using the smaller ring,
+// so it is kept until the recorder is destroyed; the retired rings never
+// add up to more than the current ring.
+struct MetricsGuiZoneRecorder {
+    enum {
+        MIN_EVENTS = 1u << 12,              // 128 KB; both must be powers of two
+        MAX_EVENTS = 1u << 18,              // 8 MB
+    };
+
+    struct Event {
+        std::atomic<char const*> mDescription;
+        std::atomic<uint64_t> mBeginTicks;
+        std::atomic<uint64_t> mEndTicks;
+        std::atomic<uint32_t> mDepth;
+        std::atomic<uint32_t> mColor;
+    };
+
+    struct EventRing {
+        Event* mEvents;
+        uint32_t mMask;                     // Number of events - 1
+        uint64_t mFirstIndex;               // Events before this index were never written to this ring
+    };
+
+    std::atomic<EventRing*> mRing;
+    std::vector<EventRing*> mRetiredRings;  // Only accessed by the owning thread
+    std::atomic<uint64_t> mClaimCount;
+    std::atomic<uint64_t> mWriteCount;
+    uint32_t mThreadIndex;
+    bool mInUse;                            // Owned by a running thread; protected by the recorder list mutex
+
+    void Record(MetricsGuiZone const* zone, uint64_t beginTicks, uint64_t endTicks, uint32_t depth)
+    {
+        auto i = mWriteCount.load(std::memory_order_relaxed);
+        auto ring = mRing.load(std::memory_order_relaxed);
+        auto event = &ring->mEvents[i & ring->mMask];
+        if (i - ring->mFirstIndex > ring->mMask &&
+            ring->mMask < MAX_EVENTS - 1 &&
+            event->mEndTicks.load(std::memory_order_relaxed) >= GetRetainTicks().load(std::memory_order_relaxed)) {
+            ring = Grow(i);
+            event = &ring->mEvents[i & ring->mMask];
+        }
+        mClaimCount.store(i + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        event->mDescription.store(zone->mDescription, std::memory_order_relaxed);
+        event->mBeginTicks.store(beginTicks, std::memory_order_relaxed);
+        event->mEndTicks.store(endTicks, std::memory_order_relaxed);
+        event->mDepth.store(depth, std::memory_order_relaxed);
+        event->mColor.store(zone->mPackedColor.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        mWriteCount.store(i + 1, std::memory_order_release);
+    }
+
+    // Copy the events that overlap [beginTicks, endTicks) into events.
+    // Returns the maximum depth + 1 of the copied events.
+    uint32_t Read(uint64_t beginTicks, uint64_t endTicks, std::vector<MetricsGuiZoneEvent>* events) const;
+
+    // Replace the ring with one twice the size, holding the same events, to
+    // write the event at index writeCount.
+    EventRing* Grow(uint64_t writeCount);
+
+    static MetricsGuiZoneRecorder* GetThreadRecorder()
+    {
+        static thread_local MetricsGuiZoneRecorder* recorder = nullptr;
+        if (recorder == nullptr) {
+            recorder = AcquireRecorder();
+        }
+        return recorder;
+    }
+
+    // Zone timers only record events while recording is enabled, which
+    // constructing a MetricsGuiTimeline does.
+    static std::atomic<bool>& GetRecordingEnabled()
+    {
+        static std::atomic<bool> enabled(false);
+        return enabled;
+    }
+
+    // Events ending at or after this time are kept, growing the ring if
+    // needed.  MetricsGuiTimeline::MarkFrame() sets it to the start of the
+    // selected frame.
+    static std::atomic<uint64_t>& GetRetainTicks()
+    {
+        static std::atomic<uint64_t> ticks(UINT64_MAX);
+        return ticks;
+    }
+
+    // A thread acquires a recorder when it first records an event, and
+    // releases it when the thread exits, so that later threads can reuse it.
+    // Recorders are never destroyed, so the events of exited threads can be
+    // drawn until their recorder is reused.
+    static MetricsGuiZoneRecorder* AcquireRecorder();
+    static void GetRecorders(std::vector<MetricsGuiZoneRecorder*>* recorders);
+};
+
+// Times the scope it is declared in and adds the elapsed ticks to a
+// MetricsGuiZone.  Each thread keeps track of its innermost timer, so that
+// the elapsed time of a nested timer can be excluded from its parent's self
+// time.  Timers must be destroyed in the reverse order they were created,
+// which scoping guarantees.
+struct MetricsGuiZoneTimer {
+    MetricsGuiZone* mZone;
+    MetricsGuiZoneThread* mThread;
+    MetricsGuiZoneTimer* mParent;
+    uint64_t mStartTicks;
+    uint64_t mChildTicks;
+    uint32_t mDepth;
+
+    explicit MetricsGuiZoneTimer(MetricsGuiZone* zone)
+        : mZone(zone)
+        , mThread(&MetricsGuiZoneThread::Get())
+        , mParent(mThread->mTimer)
+        , mChildTicks(0)
+        , mDepth(mParent == nullptr ? 0 : mParent->mDepth + 1)
+    {
+        mThread->mTimer = this;
+        mStartTicks = GetPerfTimerCount();
+    }
+
+    ~MetricsGuiZoneTimer()
+    {
+        auto endTicks = GetPerfTimerCount();
+        auto ticks = endTicks - mStartTicks;
+        mZone->AddTicks(mThread, ticks, ticks - mChildTicks);
+        if (mParent != nullptr) {
+            mParent->mChildTicks += ticks;
+        }
+        mThread->mTimer = mParent;
+        if (MetricsGuiZoneRecorder::GetRecordingEnabled().load(std::memory_order_relaxed)) {
+            MetricsGuiZoneRecorder::GetThreadRecorder()->Record(mZone, mStartTicks, endTicks, mDepth);
+        }
+    }
+
+    static MetricsGuiZoneTimer*& GetThreadTimer()
+    {
+        return MetricsGuiZoneThread::Get().mTimer;
+    }
+
+    MetricsGuiZoneTimer(MetricsGuiZoneTimer const&) = delete;
+    MetricsGuiZoneTimer& operator=(MetricsGuiZoneTimer const&) = delete;
+};
+
+// Keeps the start times of recent frames, and draws the zone events of a
+// selected frame with a lane for each thread that recorded events, and
+// nested zones in rows below their parents.  Zones narrower than
+// mMinZoneWidth pixels are merged with adjacent narrow zones, and culled if
+// the merged bar is still too narrow.
+// -----------------------------------------------------------------
+// | Thread 0                                                      |
+// | [CPU frame.................................] [CPU render.....] |
+// |   [zone A......] [zone B] [...]               [zone C]        |
+// | Thread 1                                                      |
+// | [zone D.......................]                               |
+// -----------------------------------------------------------------
+struct MetricsGuiTimeline {
+    enum { NUM_FRAMES = 256 };
+
+    struct Lane {
+        uint32_t mThreadIndex;
+        uint32_t mEventBegin;               // Range of the lane's events in mEvents
+        uint32_t mEventEnd;
+        uint32_t mDepthCount;
+    };
+
+    struct Run {
+        char const* mDescription;
+        uint32_t mColor;
+        uint64_t mTicks;
+        float mX0;
+        float mX1;
+        uint32_t mCount;
+    };
+
+    uint64_t mFrameTicks[NUM_FRAMES];       // Ring buffer of frame start times
+    uint32_t mFrameHead;                    // Index of the oldest start time, where the next will be written
+    uint32_t mFrameCount;
+
+    // Scratch storage reused between draws
+    std::vector<MetricsGuiZoneRecorder*> mRecorders;
+    std::vector<MetricsGuiZoneEvent> mEvents;
+    std::vector<Lane> mLanes;
+    std::vector<Run> mRuns;                 // Pending run of narrow zones at each depth
+
+    // Draw options:
+    uint32_t mSelectedFrame;        // frame to draw, counting back from the newest complete frame
+    float mMinZoneWidth;            // width in pixels below which zones are merged or culled
+
+    // Constructing a timeline enables zone recording.
+    MetricsGuiTimeline();
+
+    // Call once per frame, at the start of the frame.
+    void MarkFrame();
+
+    void DrawTimeline();
+};
+
+// METRICS_GUI_ZONE(zone) times the rest of the enclosing scope into zone.
+// Define METRICS_GUI_NO_ZONES to compile zone timers out.
+#define METRICS_GUI_ZONE_NAME2(line) metricsGuiZoneTimer##line
+#define METRICS_GUI_ZONE_NAME(line) METRICS_GUI_ZONE_NAME2(line)
+#ifdef METRICS_GUI_NO_ZONES
+#define METRICS_GUI_ZONE(zone) do {} while (0)
+#else
+#define METRICS_GUI_ZONE(zone) MetricsGuiZoneTimer METRICS_GUI_ZONE_NAME(__LINE__)(&(zone))
+#endif
+
+#endif // ifndef METRICS_GUI_ZONE_H
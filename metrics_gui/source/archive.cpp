@@ -0,0 +1,461 @@
+/*
+Copyright 2017 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "../include/metrics_gui/metrics_gui.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <string.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace {
+
+// Each value after the first in a block starts with a control code:
+//
+//   0  followed by an Elias gamma coded count of repeats of the previous value
+//   10 followed by the XOR in the previous XOR's window
+//   11 followed by 5 bits of leading zeros, 5 bits of (meaningful bits - 1),
+//      and the meaningful bits of the XOR
+//
+// The first value in a block is stored raw.
+
+uint32_t CountLeadingZeros(
+    uint32_t x)
+{
+    assert(x != 0);
+#if defined(_MSC_VER)
+    unsigned long i;
+    _BitScanReverse(&i, x);
+    return 31 - i;
+#else
+    return (uint32_t) __builtin_clz(x);
+#endif
+}
+
+uint32_t CountTrailingZeros(
+    uint32_t x)
+{
+    assert(x != 0);
+#if defined(_MSC_VER)
+    unsigned long i;
+    _BitScanForward(&i, x);
+    return i;
+#else
+    return (uint32_t) __builtin_ctz(x);
+#endif
+}
+
+void WriteBits(
+    MetricsGuiHistoryArchive::Block* block,
+    uint64_t value,
+    uint32_t bitCount)
+{
+    assert(bitCount <= 64);
+    while (bitCount > 0) {
+        auto used = (uint32_t) (block->mBitCount & 63);
+        if (used == 0) {
+            block->mBits.emplace_back(0);
+        }
+        auto count = std::min(bitCount, 64 - used);
+        auto bits = (value >> (bitCount - count)) & (count == 64 ? ~0ull : ((1ull << count) - 1));
+        block->mBits.back() |= bits << (64 - used - count);
+        block->mBitCount += count;
+        bitCount -= count;
+    }
+}
+
+void WriteRunLength(
+    MetricsGuiHistoryArchive::Block* block,
+    uint32_t runLength)
+{
+    auto n = 31 - CountLeadingZeros(runLength);
+    WriteBits(block, 0, n);
+    WriteBits(block, runLength, n + 1);
+}
+
+struct BitReader {
+    uint64_t const* mBits;
+    uint64_t mPosition;
+
+    uint64_t Read(uint32_t bitCount)
+    {
+        uint64_t value = 0;
+        while (bitCount > 0) {
+            auto used = (uint32_t) (mPosition & 63);
+            auto count = std::min(bitCount, 64 - used);
+            auto word = mBits[mPosition >> 6];
+            value = (value << count) | ((word << used) >> (64 - count));
+            mPosition += count;
+            bitCount -= count;
+        }
+        return value;
+    }
+
+    uint32_t ReadRunLength()
+    {
+        uint32_t n = 0;
+        while (Read(1) == 0) {
+            ++n;
+        }
+        return (uint32_t) (((uint64_t) 1 << n) | Read(n));
+    }
+};
+
+float BitsToFloat(
+    uint32_t bits)
+{
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Decode values [begin, end) of a block holding count values, of which the
+// last runLength are repeats that have not been stored yet.
+void DecodeBlock(
+    MetricsGuiHistoryArchive::Block const& block,
+    uint32_t count,
+    uint32_t runLength,
+    uint32_t begin,
+    uint32_t end,
+    float* dst)
+{
+    BitReader reader = { block.mBits.data(), 0 };
+    auto valueBits = (uint32_t) reader.Read(32);
+    uint32_t leadingZeros = 0;
+    uint32_t meaningfulBits = 0;
+    uint32_t repeatCount = 0;
+    for (uint32_t i = 0; i < end; ++i) {
+        if (i > 0) {
+            if (repeatCount > 0) {
+                repeatCount -= 1;
+            } else if (i >= count - runLength) {
+                // Pending repeats of the last stored value
+            } else if (reader.Read(1) == 0) {
+                repeatCount = reader.ReadRunLength() - 1;
+            } else {
+                if (reader.Read(1) == 1) {
+                    leadingZeros = (uint32_t) reader.Read(5);
+                    meaningfulBits = (uint32_t) reader.Read(5) + 1;
+                }
+                auto x = (uint32_t) reader.Read(meaningfulBits);
+                valueBits ^= x << (32 - leadingZeros - meaningfulBits);
+            }
+        }
+        if (i >= begin) {
+            *dst++ = BitsToFloat(valueBits);
+        }
+    }
+}
+
+// Scratch memory for decoded values.  Archives are only read while
+// updating and drawing plots, which only happens on the ImGui thread.
+float* GetDecodeBuffer(
+    uint32_t size)
+{
+    static std::vector<float> scratch;
+    if (scratch.size() < size) {
+        scratch.resize(size);
+    }
+    return scratch.data();
+}
+
+void MergeAggregate(
+    MetricsGuiAggregate* dst,
+    MetricsGuiAggregate const& src)
+{
+    if (dst->mCount == 0) {
+        *dst = src;
+        return;
+    }
+    dst->mMin = std::min(dst->mMin, src.mMin);
+    dst->mMax = std::max(dst->mMax, src.mMax);
+    dst->mSum += src.mSum;
+    dst->mCount += src.mCount;
+}
+
+// Aggregate each run of valuesPerRun of count values, the last of which may
+// be shorter.
+void AggregateRuns(
+    float const* values,
+    uint32_t count,
+    uint32_t valuesPerRun,
+    MetricsGuiAggregate* dst)
+{
+    for (uint32_t i = 0; i < count; i += valuesPerRun) {
+        auto runEnd = std::min(count, i + valuesPerRun);
+        MetricsGuiAggregate aggregate = { values[i], values[i], 0.f, runEnd - i };
+        for (auto j = i; j < runEnd; ++j) {
+            aggregate.mMin = std::min(aggregate.mMin, values[j]);
+            aggregate.mMax = std::max(aggregate.mMax, values[j]);
+            aggregate.mSum += values[j];
+        }
+        *dst++ = aggregate;
+    }
+}
+
+}
+
+void MetricsGuiHistoryArchive::Initialize(
+    uint32_t valuesPerBlock,
+    uint32_t blockCount)
+{
+    assert(valuesPerBlock > 0);
+    assert(blockCount > 1);
+
+    mBlocks.clear();
+    mBlocks.resize(blockCount);
+    for (auto& block : mBlocks) {
+        block.mBitCount = 0;
+        block.mAggregate = MetricsGuiAggregate();
+    }
+    mValuesPerBlock = valuesPerBlock;
+    mBlockHead = 0;
+    mBlockCount = 0;
+    mValuesPerRun = 0;
+    mPrevValueBits = 0;
+    mLeadingZeros = 0;
+    mMeaningfulBits = 0;
+    mRunLength = 0;
+}
+
+void MetricsGuiHistoryArchive::AddValue(
+    float value)
+{
+    auto size = (uint32_t) mBlocks.size();
+    auto block = mBlockCount == 0 ? nullptr : &mBlocks[(mBlockHead + mBlockCount - 1) % size];
+
+    // Seal the newest block when it is full, and start a new one, dropping
+    // the oldest block if there is no room
+    if (block == nullptr || block->mAggregate.mCount == mValuesPerBlock) {
+        if (block != nullptr) {
+            if (mRunLength > 0) {
+                WriteBits(block, 0, 1);
+                WriteRunLength(block, mRunLength);
+            }
+            block->mBits.shrink_to_fit();
+        }
+
+        if (mBlockCount == size) {
+            mBlockHead = mBlockHead + 1 == size ? 0 : mBlockHead + 1;
+            mBlockCount -= 1;
+        }
+        block = &mBlocks[(mBlockHead + mBlockCount) % size];
+        std::vector<MetricsGuiAggregate>().swap(block->mRuns);
+        block->mBits.clear();
+        block->mBitCount = 0;
+        block->mAggregate = MetricsGuiAggregate();
+        mBlockCount += 1;
+    }
+
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    auto& aggregate = block->mAggregate;
+    if (aggregate.mCount == 0) {
+        aggregate.mMin = value;
+        aggregate.mMax = value;
+        aggregate.mSum = 0.f;
+        WriteBits(block, bits, 32);
+        mLeadingZeros = 0;
+        mMeaningfulBits = 0;
+        mRunLength = 0;
+    } else {
+        auto x = bits ^ mPrevValueBits;
+        if (x == 0) {
+            mRunLength += 1;
+        } else {
+            if (mRunLength > 0) {
+                WriteBits(block, 0, 1);
+                WriteRunLength(block, mRunLength);
+                mRunLength = 0;
+            }
+
+            auto leadingZeros = CountLeadingZeros(x);
+            auto trailingZeros = CountTrailingZeros(x);
+            if (mMeaningfulBits > 0 &&
+                leadingZeros >= mLeadingZeros &&
+                trailingZeros >= 32 - mLeadingZeros - mMeaningfulBits) {
+                WriteBits(block, 2, 2);
+                WriteBits(block, x >> (32 - mLeadingZeros - mMeaningfulBits), mMeaningfulBits);
+            } else {
+                mLeadingZeros = leadingZeros;
+                mMeaningfulBits = 32 - leadingZeros - trailingZeros;
+                WriteBits(block, 3, 2);
+                WriteBits(block, mLeadingZeros, 5);
+                WriteBits(block, mMeaningfulBits - 1, 5);
+                WriteBits(block, x >> trailingZeros, mMeaningfulBits);
+            }
+        }
+        aggregate.mMin = std::min(aggregate.mMin, value);
+        aggregate.mMax = std::max(aggregate.mMax, value);
+    }
+    aggregate.mSum += value;
+    aggregate.mCount += 1;
+    mPrevValueBits = bits;
+}
+
+uint32_t MetricsGuiHistoryArchive::GetValueCount() const
+{
+    if (mBlockCount == 0) {
+        return 0;
+    }
+    auto newest = mBlocks[(mBlockHead + mBlockCount - 1) % mBlocks.size()].mAggregate.mCount;
+    return (mBlockCount - 1) * mValuesPerBlock + newest;
+}
+
+void MetricsGuiHistoryArchive::GetValues(
+    uint32_t begin,
+    uint32_t end,
+    float* dst) const
+{
+    assert(begin <= end && end <= GetValueCount());
+    auto size = (uint32_t) mBlocks.size();
+    while (begin < end) {
+        auto i = begin / mValuesPerBlock;
+        auto blockBegin = i * mValuesPerBlock;
+        auto blockEnd = std::min(end, blockBegin + mValuesPerBlock);
+        auto const& block = mBlocks[(mBlockHead + i) % size];
+        DecodeBlock(
+            block,
+            block.mAggregate.mCount,
+            i + 1 < mBlockCount ? 0 : mRunLength,
+            begin - blockBegin,
+            blockEnd - blockBegin,
+            dst);
+        dst += blockEnd - begin;
+        begin = blockEnd;
+    }
+}
+
+MetricsGuiAggregate MetricsGuiHistoryArchive::GetBlockAggregate(
+    uint32_t begin,
+    uint32_t end) const
+{
+    assert(begin <= end && end <= GetValueCount());
+    MetricsGuiAggregate aggregate = {};
+    if (begin == end) {
+        return aggregate;
+    }
+    auto size = (uint32_t) mBlocks.size();
+    for (auto i = begin / mValuesPerBlock, N = (end - 1) / mValuesPerBlock; i <= N; ++i) {
+        MergeAggregate(&aggregate, mBlocks[(mBlockHead + i) % size].mAggregate);
+    }
+    return aggregate;
+}
+
+uint32_t MetricsGuiHistoryArchive::GetValuesPerRun(
+    uint32_t minValuesPerRun) const
+{
+    if (minValuesPerRun >= mValuesPerBlock) {
+        return (minValuesPerRun + mValuesPerBlock - 1) / mValuesPerBlock * mValuesPerBlock;
+    }
+    auto valuesPerRun = std::max(1u, minValuesPerRun);
+    while (mValuesPerBlock % valuesPerRun != 0) {
+        ++valuesPerRun;
+    }
+    return valuesPerRun;
+}
+
+uint32_t MetricsGuiHistoryArchive::GetRunAggregates(
+    uint32_t begin,
+    uint32_t end,
+    uint32_t valuesPerRun,
+    MetricsGuiAggregate* dst) const
+{
+    assert(begin <= end && end <= GetValueCount());
+    assert(valuesPerRun > 0 && (valuesPerRun % mValuesPerBlock == 0 || mValuesPerBlock % valuesPerRun == 0));
+    if (begin == end) {
+        return 0;
+    }
+    auto size = (uint32_t) mBlocks.size();
+    auto firstRun = begin / valuesPerRun;
+    auto runCount = (end - 1) / valuesPerRun - firstRun + 1;
+    auto firstBlock = firstRun * valuesPerRun / mValuesPerBlock;
+    auto lastBlock = std::min(mBlockCount - 1, ((firstRun + runCount) * valuesPerRun - 1) / mValuesPerBlock);
+
+    // Drop the runs cached at another run length, or for blocks that are
+    // no longer read
+    for (uint32_t i = 0; i < mBlockCount; ++i) {
+        auto& runs = mBlocks[(mBlockHead + i) % size].mRuns;
+        if (!runs.empty() && (valuesPerRun != mValuesPerRun || i < firstBlock || i > lastBlock)) {
+            std::vector<MetricsGuiAggregate>().swap(runs);
+        }
+    }
+    mValuesPerRun = valuesPerRun;
+
+    for (uint32_t i = 0; i < runCount; ++i) {
+        dst[i] = MetricsGuiAggregate();
+    }
+    for (auto i = firstBlock; i <= lastBlock; ++i) {
+        auto const& block = mBlocks[(mBlockHead + i) % size];
+        auto blockBegin = i * mValuesPerBlock;
+        auto count = block.mAggregate.mCount;
+        if (valuesPerRun >= mValuesPerBlock) {
+            MergeAggregate(&dst[blockBegin / valuesPerRun - firstRun], block.mAggregate);
+            continue;
+        }
+
+        // The newest block is aggregated again on every call, as it changes
+        // with every value added
+        static std::vector<MetricsGuiAggregate> newestRuns;
+        auto blockRunCount = (count + valuesPerRun - 1) / valuesPerRun;
+        MetricsGuiAggregate const* runs;
+        if (i + 1 < mBlockCount) {
+            if (block.mRuns.empty()) {
+                auto values = GetDecodeBuffer(count);
+                DecodeBlock(block, count, 0, 0, count, values);
+                block.mRuns.resize(blockRunCount);
+                AggregateRuns(values, count, valuesPerRun, block.mRuns.data());
+            }
+            runs = block.mRuns.data();
+        } else {
+            auto values = GetDecodeBuffer(count);
+            DecodeBlock(block, count, mRunLength, 0, count, values);
+            if (newestRuns.size() < blockRunCount) {
+                newestRuns.resize(blockRunCount);
+            }
+            AggregateRuns(values, count, valuesPerRun, newestRuns.data());
+            runs = newestRuns.data();
+        }
+
+        auto blockFirstRun = blockBegin / valuesPerRun;
+        for (uint32_t j = 0; j < blockRunCount; ++j) {
+            auto run = blockFirstRun + j;
+            if (run >= firstRun && run - firstRun < runCount) {
+                dst[run - firstRun] = runs[j];
+            }
+        }
+    }
+    return runCount;
+}
+
+size_t MetricsGuiHistoryArchive::GetMemorySize() const
+{
+    auto size = sizeof(*this) + mBlocks.capacity() * sizeof(Block);
+    for (auto const& block : mBlocks) {
+        size += block.mBits.capacity() * sizeof(uint64_t);
+        size += block.mRuns.capacity() * sizeof(MetricsGuiAggregate);
+    }
+    return size;
+}
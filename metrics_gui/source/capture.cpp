@@ -0,0 +1,350 @@
+/*
+Copyright 2017 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "../include/metrics_gui/capture.h"
+#ifndef NOMINMAX
+#define NOMINMAX // perf_timer.h includes windows.h on Windows
+#endif
+#include "../../portable/perf_timer.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <string.h>
+
+namespace {
+
+FILE* OpenFile(
+    char const* path,
+    char const* mode)
+{
+#if defined(_MSC_VER)
+    FILE* file = nullptr;
+    return fopen_s(&file, path, mode) == 0 ? file : nullptr;
+#else
+    return fopen(path, mode);
+#endif
+}
+
+bool WritePadding(
+    FILE* file,
+    uint64_t size)
+{
+    static uint8_t const zeros[8] = {};
+    auto count = (size_t) ((8 - size % 8) % 8);
+    return fwrite(zeros, 1, count, file) == count;
+}
+
+bool WriteChunk(
+    FILE* file,
+    MetricsGuiCaptureWriter::Buffer const& buffer,
+    uint32_t metricCount,
+    uint32_t framesPerChunk)
+{
+    auto frameCount = buffer.mChunk.mFrameCount;
+    auto ok = fwrite(&buffer.mChunk, sizeof(buffer.mChunk), 1, file) == 1;
+    ok = ok && fwrite(buffer.mTimestamps.data(), sizeof(uint64_t), frameCount, file) == frameCount;
+    for (uint32_t i = 0; ok && i < metricCount; ++i) {
+        ok = fwrite(buffer.mValues.data() + (size_t) i * framesPerChunk, sizeof(float), frameCount, file) == frameCount;
+    }
+    return ok && WritePadding(file, (uint64_t) frameCount * metricCount * sizeof(float));
+}
+
+// Write full buffers in the order they were filled, until stopped with no
+// buffers left to write.
+void WriterThread(
+    MetricsGuiCaptureWriter* writer)
+{
+    std::unique_lock<std::mutex> lock(writer->mMutex);
+    for (;;) {
+        writer->mCondition.wait(lock, [writer]() {
+            return writer->mStop || writer->mBuffers[writer->mWriteIndex].mFull;
+        });
+
+        auto buffer = &writer->mBuffers[writer->mWriteIndex];
+        if (!buffer->mFull) {
+            break;
+        }
+
+        lock.unlock();
+        auto const& chunk = buffer->mChunk;
+        MetricsGuiCaptureIndexEntry entry = {};
+        entry.mOffset = writer->mFileOffset;
+        entry.mFirstFrame = chunk.mFirstFrame;
+        entry.mFirstTimestamp = chunk.mFirstTimestamp;
+        entry.mLastTimestamp = chunk.mLastTimestamp;
+        entry.mFrameCount = chunk.mFrameCount;
+        if (WriteChunk(writer->mFile, *buffer, (uint32_t) writer->mMetrics.size(), writer->mFramesPerChunk)) {
+            writer->mIndex.emplace_back(entry);
+            writer->mFileOffset += MetricsGuiCaptureChunk::GetSize(chunk.mFrameCount, (uint32_t) writer->mMetrics.size());
+        } else {
+            writer->mWriteFailed.store(true, std::memory_order_relaxed);
+        }
+        lock.lock();
+
+        buffer->mFull = false;
+        writer->mWriteIndex ^= 1;
+    }
+}
+
+void ResetChunk(
+    MetricsGuiCaptureWriter::Buffer* buffer,
+    uint64_t firstFrame)
+{
+    buffer->mChunk.mMagic = MetricsGuiCaptureChunk::MAGIC;
+    buffer->mChunk.mFrameCount = 0;
+    buffer->mChunk.mFirstFrame = firstFrame;
+    buffer->mChunk.mFirstTimestamp = 0;
+    buffer->mChunk.mLastTimestamp = 0;
+}
+
+}
+
+MetricsGuiCaptureWriter::MetricsGuiCaptureWriter()
+    : mOverheadMetric("Capture overhead", "s", MetricsGuiMetric::USE_SI_UNIT_PREFIX)
+    , mFillIndex(0)
+    , mWriteIndex(0)
+    , mFramesPerChunk(0)
+    , mFrameCount(0)
+    , mDroppedFrameCount(0)
+    , mFileOffset(0)
+    , mWriteFailed(false)
+    , mFile(nullptr)
+    , mStop(false)
+{
+}
+
+MetricsGuiCaptureWriter::~MetricsGuiCaptureWriter()
+{
+    Close();
+}
+
+bool MetricsGuiCaptureWriter::Open(
+    char const* path,
+    MetricsGuiMetric const* const* metrics,
+    uint32_t metricCount,
+    uint32_t framesPerChunk)
+{
+    assert(framesPerChunk > 0);
+    Close();
+
+    mFile = OpenFile(path, "wb");
+    if (mFile == nullptr) {
+        return false;
+    }
+
+    auto frequency = GetPerfTimerFrequency();
+    MetricsGuiCaptureHeader header = {};
+    memcpy(header.mMagic, "MGUICAP", 8);
+    header.mVersion = MetricsGuiCaptureHeader::VERSION;
+    header.mMetricCount = metricCount;
+    header.mTimerNumerator = frequency.Numerator;
+    header.mTimerDenominator = frequency.Denominator;
+    auto ok = fwrite(&header, sizeof(header), 1, mFile) == 1;
+    mFileOffset = sizeof(header);
+
+    for (uint32_t i = 0; ok && i < metricCount; ++i) {
+        auto metric = metrics[i];
+        auto descriptionLength = std::min(strlen(metric->mDescription), (size_t) UINT16_MAX);
+        auto unitsLength = std::min(strlen(metric->mUnits), (size_t) UINT16_MAX);
+        MetricsGuiCaptureMetric m = {};
+        m.mFlags = metric->mFlags;
+        m.mKnownMinValue = metric->mKnownMinValue;
+        m.mKnownMaxValue = metric->mKnownMaxValue;
+        m.mDescriptionLength = (uint16_t) descriptionLength;
+        m.mUnitsLength = (uint16_t) unitsLength;
+        ok = fwrite(&m, sizeof(m), 1, mFile) == 1 &&
+             fwrite(metric->mDescription, 1, descriptionLength, mFile) == descriptionLength &&
+             fwrite(metric->mUnits, 1, unitsLength, mFile) == unitsLength;
+        mFileOffset += sizeof(m) + descriptionLength + unitsLength;
+    }
+    ok = ok && WritePadding(mFile, mFileOffset);
+    mFileOffset = (mFileOffset + 7) & ~7ull;
+    if (!ok) {
+        fclose(mFile);
+        mFile = nullptr;
+        return false;
+    }
+
+    mMetrics.assign(metrics, metrics + metricCount);
+    mFramesPerChunk = framesPerChunk;
+    for (auto& buffer : mBuffers) {
+        buffer.mTimestamps.resize(framesPerChunk);
+        buffer.mValues.resize((size_t) framesPerChunk * metricCount);
+        buffer.mFull = false;
+        ResetChunk(&buffer, 0);
+    }
+    mFillIndex = 0;
+    mWriteIndex = 0;
+    mFrameCount = 0;
+    mDroppedFrameCount = 0;
+    mIndex.clear();
+    mWriteFailed.store(false, std::memory_order_relaxed);
+    mStop = false;
+    mThread = std::thread(WriterThread, this);
+    return true;
+}
+
+void MetricsGuiCaptureWriter::RecordFrame()
+{
+    RecordFrame(GetPerfTimerCount());
+}
+
+void MetricsGuiCaptureWriter::RecordFrame(
+    uint64_t timestamp)
+{
+    if (mFile == nullptr) {
+        return;
+    }
+
+    auto t0 = GetPerfTimerCount();
+
+    auto buffer = &mBuffers[mFillIndex];
+    auto frame = buffer->mChunk.mFrameCount;
+    if (frame == 0) {
+        buffer->mChunk.mFirstTimestamp = timestamp;
+    }
+    buffer->mChunk.mLastTimestamp = timestamp;
+    buffer->mChunk.mFrameCount = frame + 1;
+    buffer->mTimestamps[frame] = timestamp;
+    auto values = buffer->mValues.data() + frame;
+    for (size_t i = 0, N = mMetrics.size(); i < N; ++i) {
+        values[i * mFramesPerChunk] = mMetrics[i]->GetLastValue();
+    }
+    mFrameCount += 1;
+
+    // Hand the chunk to the writer thread if it is full and the other buffer
+    // is free, otherwise drop it.
+    if (frame + 1 == mFramesPerChunk) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mBuffers[mFillIndex ^ 1].mFull) {
+            mDroppedFrameCount += mFramesPerChunk;
+        } else {
+            buffer->mFull = true;
+            mFillIndex ^= 1;
+            mCondition.notify_one();
+        }
+        ResetChunk(&mBuffers[mFillIndex], mFrameCount);
+    }
+
+    auto frequency = GetPerfTimerFrequency();
+    mOverheadMetric.AddNewValue((float) ((double) (GetPerfTimerCount() - t0) * frequency.Denominator / frequency.Numerator));
+}
+
+bool MetricsGuiCaptureWriter::Close()
+{
+    if (mFile == nullptr) {
+        return true;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto buffer = &mBuffers[mFillIndex];
+        if (buffer->mChunk.mFrameCount > 0) {
+            buffer->mFull = true;
+        }
+        mStop = true;
+        mCondition.notify_one();
+    }
+    mThread.join();
+
+    // Only write the index if all chunks were written, otherwise readers
+    // rebuild it from the chunks that made it to the file.
+    auto ok = !mWriteFailed.load(std::memory_order_relaxed);
+    if (ok) {
+        MetricsGuiCaptureTrailer trailer = {};
+        trailer.mIndexOffset = mFileOffset;
+        trailer.mChunkCount = (uint32_t) mIndex.size();
+        trailer.mMagic = MetricsGuiCaptureTrailer::MAGIC;
+        ok = fwrite(mIndex.data(), sizeof(MetricsGuiCaptureIndexEntry), mIndex.size(), mFile) == mIndex.size() &&
+             fwrite(&trailer, sizeof(trailer), 1, mFile) == 1;
+    }
+    ok = fclose(mFile) == 0 && ok;
+    mFile = nullptr;
+    mMetrics.clear();
+    return ok;
+}
+
+void MetricsGuiCaptureReader::InitializeMetric(
+    uint32_t metricIndex,
+    MetricsGuiMetric* metric,
+    uint32_t historySize) const
+{
+    auto const& m = mMetrics[metricIndex];
+    metric->Initialize(m.mDescription.c_str(), m.mUnits.c_str(), m.mFlags, historySize);
+    metric->mKnownMinValue = m.mKnownMinValue;
+    metric->mKnownMaxValue = m.mKnownMaxValue;
+}
+
+void MetricsGuiCaptureReader::Replay(
+    uint64_t beginFrame,
+    uint64_t endFrame,
+    MetricsGuiMetric* const* metrics) const
+{
+    for (uint32_t i = 0; i < mHeader.mMetricCount; ++i) {
+        if (metrics[i] != nullptr) {
+            metrics[i]->ClearHistory();
+        }
+    }
+
+    // Find the timestamp of the last frame replayed, which is moved to now
+    auto firstChunk = FindChunkByFrame(beginFrame);
+    uint64_t lastTimestamp = 0;
+    auto found = false;
+    for (auto chunk = firstChunk, N = mChunks.size(); chunk < N && mChunks[chunk].mFirstFrame < endFrame; ++chunk) {
+        auto const& entry = mChunks[chunk];
+        auto timestamps = GetTimestamps(chunk);
+        if (timestamps != nullptr) {
+            auto end = std::min(endFrame, entry.mFirstFrame + entry.mFrameCount) - entry.mFirstFrame;
+            lastTimestamp = timestamps[end - 1];
+            found = true;
+        }
+    }
+    if (!found) {
+        return;
+    }
+
+    auto now = GetPerfTimerCount();
+    auto frequency = GetPerfTimerFrequency();
+    auto ticksPerCapturedTick =
+        ((double) frequency.Numerator * mHeader.mTimerDenominator) /
+        ((double) frequency.Denominator * mHeader.mTimerNumerator);
+
+    for (auto chunk = firstChunk, N = mChunks.size(); chunk < N && mChunks[chunk].mFirstFrame < endFrame; ++chunk) {
+        auto const& entry = mChunks[chunk];
+        auto begin = (uint32_t) (std::max(beginFrame, entry.mFirstFrame) - entry.mFirstFrame);
+        auto end = (uint32_t) (std::min(endFrame, entry.mFirstFrame + entry.mFrameCount) - entry.mFirstFrame);
+        auto timestamps = GetTimestamps(chunk);
+        if (timestamps == nullptr) {
+            continue;
+        }
+        for (uint32_t i = 0; i < mHeader.mMetricCount; ++i) {
+            if (metrics[i] == nullptr) {
+                continue;
+            }
+            auto values = GetValues(chunk, i);
+            for (auto j = begin; j < end; ++j) {
+                auto age = (uint64_t) ((double) (lastTimestamp - timestamps[j]) * ticksPerCapturedTick);
+                metrics[i]->AddNewValue(values[j], now - std::min(age, now));
+            }
+        }
+    }
+}
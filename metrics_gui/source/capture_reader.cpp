@@ -0,0 +1,300 @@
+/*
+Copyright 2017 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+#include "../include/metrics_gui/capture.h"
+
+#include <algorithm>
+#include <string.h>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// Use the index at the end of the file if it is intact.  Only the index is
+// read: entries must cover the chunk data contiguously, but the chunk
+// headers they point to are checked lazily by IsChunkValid(), so opening a
+// capture doesn't page in the whole file.  Damaged indices fall back to
+// walking the chunks.
+bool ReadIndex(
+    MetricsGuiCaptureReader* reader,
+    uint64_t dataOffset)
+{
+    if (reader->mSize < dataOffset + sizeof(MetricsGuiCaptureTrailer)) {
+        return false;
+    }
+
+    MetricsGuiCaptureTrailer trailer;
+    memcpy(&trailer, reader->mData + reader->mSize - sizeof(trailer), sizeof(trailer));
+    if (trailer.mMagic != MetricsGuiCaptureTrailer::MAGIC ||
+        trailer.mIndexOffset < dataOffset ||
+        trailer.mIndexOffset + (uint64_t) trailer.mChunkCount * sizeof(MetricsGuiCaptureIndexEntry) + sizeof(trailer) != reader->mSize) {
+        return false;
+    }
+
+    reader->mChunks.resize(trailer.mChunkCount);
+    memcpy(reader->mChunks.data(), reader->mData + trailer.mIndexOffset, trailer.mChunkCount * sizeof(MetricsGuiCaptureIndexEntry));
+
+    auto offset = dataOffset;
+    for (auto const& entry : reader->mChunks) {
+        if (entry.mOffset != offset || entry.mFrameCount == 0) {
+            return false;
+        }
+        offset += MetricsGuiCaptureChunk::GetSize(entry.mFrameCount, reader->mHeader.mMetricCount);
+        if (offset > trailer.mIndexOffset) {
+            return false;
+        }
+    }
+    reader->mChunkStates.assign(reader->mChunks.size(), MetricsGuiCaptureReader::CHUNK_UNCHECKED);
+    return offset == trailer.mIndexOffset;
+}
+
+// Rebuild the index of a capture that was not closed, up to the first
+// incomplete chunk.
+void BuildIndex(
+    MetricsGuiCaptureReader* reader,
+    uint64_t dataOffset)
+{
+    reader->mChunks.clear();
+    for (auto offset = dataOffset; offset + sizeof(MetricsGuiCaptureChunk) <= reader->mSize; ) {
+        MetricsGuiCaptureChunk chunk;
+        memcpy(&chunk, reader->mData + offset, sizeof(chunk));
+        auto size = MetricsGuiCaptureChunk::GetSize(chunk.mFrameCount, reader->mHeader.mMetricCount);
+        if (chunk.mMagic != MetricsGuiCaptureChunk::MAGIC ||
+            chunk.mFrameCount == 0 ||
+            offset + size > reader->mSize) {
+            break;
+        }
+
+        MetricsGuiCaptureIndexEntry entry = {};
+        entry.mOffset = offset;
+        entry.mFirstFrame = chunk.mFirstFrame;
+        entry.mFirstTimestamp = chunk.mFirstTimestamp;
+        entry.mLastTimestamp = chunk.mLastTimestamp;
+        entry.mFrameCount = chunk.mFrameCount;
+        reader->mChunks.emplace_back(entry);
+        offset += size;
+    }
+
+    // Walking the chunks checked their headers
+    reader->mChunkStates.assign(reader->mChunks.size(), MetricsGuiCaptureReader::CHUNK_VALID);
+}
+
+}
+
+MetricsGuiCaptureReader::MetricsGuiCaptureReader()
+    : mData(nullptr)
+    , mSize(0)
+#if defined(_WIN32)
+    , mFile(INVALID_HANDLE_VALUE)
+    , mMapping(nullptr)
+#else
+    , mFile(-1)
+#endif
+{
+    memset(&mHeader, 0, sizeof(mHeader));
+}
+
+MetricsGuiCaptureReader::~MetricsGuiCaptureReader()
+{
+    Close();
+}
+
+bool MetricsGuiCaptureReader::Open(
+    char const* path)
+{
+    Close();
+
+#if defined(_WIN32)
+    mFile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    LARGE_INTEGER size;
+    if (mFile == INVALID_HANDLE_VALUE || !GetFileSizeEx(mFile, &size) || size.QuadPart == 0) {
+        Close();
+        return false;
+    }
+    mMapping = CreateFileMappingA(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    auto data = mMapping == nullptr ? nullptr : MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+    if (data == nullptr) {
+        Close();
+        return false;
+    }
+    mSize = (uint64_t) size.QuadPart;
+#else
+    mFile = open(path, O_RDONLY);
+    struct stat st;
+    if (mFile == -1 || fstat(mFile, &st) != 0 || st.st_size == 0) {
+        Close();
+        return false;
+    }
+    auto data = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_SHARED, mFile, 0);
+    if (data == MAP_FAILED) {
+        Close();
+        return false;
+    }
+    mSize = (uint64_t) st.st_size;
+#endif
+    mData = (uint8_t const*) data;
+
+    // Read the header and metric descriptions.
+    if (mSize < sizeof(mHeader)) {
+        Close();
+        return false;
+    }
+    memcpy(&mHeader, mData, sizeof(mHeader));
+    if (memcmp(mHeader.mMagic, "MGUICAP", sizeof(mHeader.mMagic)) != 0 ||
+        mHeader.mVersion != MetricsGuiCaptureHeader::VERSION) {
+        Close();
+        return false;
+    }
+
+    uint64_t offset = sizeof(mHeader);
+    mMetrics.resize(mHeader.mMetricCount);
+    for (auto& metric : mMetrics) {
+        MetricsGuiCaptureMetric m;
+        if (offset + sizeof(m) > mSize) {
+            Close();
+            return false;
+        }
+        memcpy(&m, mData + offset, sizeof(m));
+        offset += sizeof(m);
+        if (offset + m.mDescriptionLength + m.mUnitsLength > mSize) {
+            Close();
+            return false;
+        }
+        metric.mDescription.assign((char const*) mData + offset, m.mDescriptionLength);
+        offset += m.mDescriptionLength;
+        metric.mUnits.assign((char const*) mData + offset, m.mUnitsLength);
+        offset += m.mUnitsLength;
+        metric.mFlags = m.mFlags;
+        metric.mKnownMinValue = m.mKnownMinValue;
+        metric.mKnownMaxValue = m.mKnownMaxValue;
+    }
+    offset = (offset + 7) & ~7ull;
+
+    if (!ReadIndex(this, offset)) {
+        BuildIndex(this, offset);
+    }
+    return true;
+}
+
+void MetricsGuiCaptureReader::Close()
+{
+#if defined(_WIN32)
+    if (mData != nullptr) {
+        UnmapViewOfFile(mData);
+    }
+    if (mMapping != nullptr) {
+        CloseHandle(mMapping);
+    }
+    if (mFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(mFile);
+    }
+    mFile = INVALID_HANDLE_VALUE;
+    mMapping = nullptr;
+#else
+    if (mData != nullptr) {
+        munmap((void*) mData, (size_t) mSize);
+    }
+    if (mFile != -1) {
+        close(mFile);
+    }
+    mFile = -1;
+#endif
+    mData = nullptr;
+    mSize = 0;
+    memset(&mHeader, 0, sizeof(mHeader));
+    mMetrics.clear();
+    mChunks.clear();
+    mChunkStates.clear();
+}
+
+uint64_t MetricsGuiCaptureReader::GetFrameEnd() const
+{
+    return mChunks.empty() ? 0 : mChunks.back().mFirstFrame + mChunks.back().mFrameCount;
+}
+
+size_t MetricsGuiCaptureReader::FindChunkByFrame(
+    uint64_t frame) const
+{
+    auto it = std::upper_bound(mChunks.begin(), mChunks.end(), frame, [](uint64_t f, MetricsGuiCaptureIndexEntry const& entry) {
+        return f < entry.mFirstFrame + entry.mFrameCount;
+    });
+    return (size_t) (it - mChunks.begin());
+}
+
+size_t MetricsGuiCaptureReader::FindChunkByTimestamp(
+    uint64_t timestamp) const
+{
+    auto it = std::upper_bound(mChunks.begin(), mChunks.end(), timestamp, [](uint64_t t, MetricsGuiCaptureIndexEntry const& entry) {
+        return t <= entry.mLastTimestamp;
+    });
+    return (size_t) (it - mChunks.begin());
+}
+
+bool MetricsGuiCaptureReader::IsChunkValid(
+    size_t chunk) const
+{
+    if (mChunkStates[chunk] == CHUNK_UNCHECKED) {
+        auto const& entry = mChunks[chunk];
+        MetricsGuiCaptureChunk header;
+        memcpy(&header, mData + entry.mOffset, sizeof(header));
+        mChunkStates[chunk] = (uint8_t) (
+            header.mMagic == MetricsGuiCaptureChunk::MAGIC &&
+            header.mFrameCount == entry.mFrameCount &&
+            header.mFirstFrame == entry.mFirstFrame ? CHUNK_VALID : CHUNK_INVALID);
+    }
+    return mChunkStates[chunk] == CHUNK_VALID;
+}
+
+uint64_t const* MetricsGuiCaptureReader::GetTimestamps(
+    size_t chunk) const
+{
+    if (!IsChunkValid(chunk)) {
+        return nullptr;
+    }
+    return (uint64_t const*) (mData + mChunks[chunk].mOffset + sizeof(MetricsGuiCaptureChunk));
+}
+
+float const* MetricsGuiCaptureReader::GetValues(
+    size_t chunk,
+    uint32_t metricIndex) const
+{
+    auto timestamps = GetTimestamps(chunk);
+    if (timestamps == nullptr) {
+        return nullptr;
+    }
+    auto frameCount = mChunks[chunk].mFrameCount;
+    return (float const*) (timestamps + frameCount) + (size_t) metricIndex * frameCount;
+}
@@ -0,0 +1,377 @@
+/*
+Copyright 2017 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Reduction kernels over float histories, and decoding of quantized
+// histories.  The instruction set is chosen at compile time (AVX2, SSE2 or
+// NEON), with a scalar fallback.  Define METRICS_GUI_NO_SIMD to force the
+// scalar versions.
+
+#ifndef METRICS_GUI_KERNELS_H
+#define METRICS_GUI_KERNELS_H
+
+#include <float.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(METRICS_GUI_NO_SIMD)
+#elif defined(__AVX2__)
+#define METRICS_GUI_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define METRICS_GUI_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define METRICS_GUI_NEON
+#include <arm_neon.h>
+#endif
+
+namespace MetricsGuiKernels {
+
+inline float ReduceMin(
+    float const* p,
+    size_t n)
+{
+    float m = FLT_MAX;
+    size_t i = 0;
+#if defined(METRICS_GUI_AVX2)
+    if (n >= 8) {
+        auto v = _mm256_loadu_ps(p);
+        for (i = 8; i + 8 <= n; i += 8) {
+            v = _mm256_min_ps(v, _mm256_loadu_ps(p + i));
+        }
+        auto h = _mm_min_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        h = _mm_min_ps(h, _mm_movehl_ps(h, h));
+        h = _mm_min_ss(h, _mm_shuffle_ps(h, h, 1));
+        m = _mm_cvtss_f32(h);
+    }
+#elif defined(METRICS_GUI_SSE2)
+    if (n >= 4) {
+        auto v = _mm_loadu_ps(p);
+        for (i = 4; i + 4 <= n; i += 4) {
+            v = _mm_min_ps(v, _mm_loadu_ps(p + i));
+        }
+        v = _mm_min_ps(v, _mm_movehl_ps(v, v));
+        v = _mm_min_ss(v, _mm_shuffle_ps(v, v, 1));
+        m = _mm_cvtss_f32(v);
+    }
+#elif defined(METRICS_GUI_NEON)
+    if (n >= 4) {
+        auto v = vld1q_f32(p);
+        for (i = 4; i + 4 <= n; i += 4) {
+            v = vminq_f32(v, vld1q_f32(p + i));
+        }
+        auto h = vpmin_f32(vget_low_f32(v), vget_high_f32(v));
+        h = vpmin_f32(h, h);
+        m = vget_lane_f32(h, 0);
+    }
+#endif
+    for (; i < n; ++i) {
+        m = p[i] < m ? p[i] : m;
+    }
+    return m;
+}
+
+inline float ReduceMax(
+    float const* p,
+    size_t n)
+{
+    float m = -FLT_MAX;
+    size_t i = 0;
+#if defined(METRICS_GUI_AVX2)
+    if (n >= 8) {
+        auto v = _mm256_loadu_ps(p);
+        for (i = 8; i + 8 <= n; i += 8) {
+            v = _mm256_max_ps(v, _mm256_loadu_ps(p + i));
+        }
+        auto h = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        h = _mm_max_ps(h, _mm_movehl_ps(h, h));
+        h = _mm_max_ss(h, _mm_shuffle_ps(h, h, 1));
+        m = _mm_cvtss_f32(h);
+    }
+#elif defined(METRICS_GUI_SSE2)
+    if (n >= 4) {
+        auto v = _mm_loadu_ps(p);
+        for (i = 4; i + 4 <= n; i += 4) {
+            v = _mm_max_ps(v, _mm_loadu_ps(p + i));
+        }
+        v = _mm_max_ps(v, _mm_movehl_ps(v, v));
+        v = _mm_max_ss(v, _mm_shuffle_ps(v, v, 1));
+        m = _mm_cvtss_f32(v);
+    }
+#elif defined(METRICS_GUI_NEON)
+    if (n >= 4) {
+        auto v = vld1q_f32(p);
+        for (i = 4; i + 4 <= n; i += 4) {
+            v = vmaxq_f32(v, vld1q_f32(p + i));
+        }
+        auto h = vpmax_f32(vget_low_f32(v), vget_high_f32(v));
+        h = vpmax_f32(h, h);
+        m = vget_lane_f32(h, 0);
+    }
+#endif
+    for (; i < n; ++i) {
+        m = p[i] > m ? p[i] : m;
+    }
+    return m;
+}
+
+inline float ReduceSum(
+    float const* p,
+    size_t n)
+{
+    float s = 0.f;
+    size_t i = 0;
+#if defined(METRICS_GUI_AVX2)
+    if (n >= 8) {
+        auto v = _mm256_setzero_ps();
+        for (; i + 8 <= n; i += 8) {
+            v = _mm256_add_ps(v, _mm256_loadu_ps(p + i));
+        }
+        auto h = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+        h = _mm_add_ss(h, _mm_shuffle_ps(h, h, 1));
+        s = _mm_cvtss_f32(h);
+    }
+#elif defined(METRICS_GUI_SSE2)
+    if (n >= 4) {
+        auto v = _mm_setzero_ps();
+        for (; i + 4 <= n; i += 4) {
+            v = _mm_add_ps(v, _mm_loadu_ps(p + i));
+        }
+        v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+        v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+        s = _mm_cvtss_f32(v);
+    }
+#elif defined(METRICS_GUI_NEON)
+    if (n >= 4) {
+        auto v = vdupq_n_f32(0.f);
+        for (; i + 4 <= n; i += 4) {
+            v = vaddq_f32(v, vld1q_f32(p + i));
+        }
+        auto h = vpadd_f32(vget_low_f32(v), vget_high_f32(v));
+        h = vpadd_f32(h, h);
+        s = vget_lane_f32(h, 0);
+    }
+#endif
+    for (; i < n; ++i) {
+        s += p[i];
+    }
+    return s;
+}
+
+// dst[i] += src[i], used to build column-wise stacked sums.
+inline void Accumulate(
+    float* dst,
+    float const* src,
+    size_t n)
+{
+    size_t i = 0;
+#if defined(METRICS_GUI_AVX2)
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i), _mm256_loadu_ps(src + i)));
+    }
+#elif defined(METRICS_GUI_SSE2)
+    for (; i + 4 <= n; i += 4) {
+        _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i), _mm_loadu_ps(src + i)));
+    }
+#elif defined(METRICS_GUI_NEON)
+    for (; i + 4 <= n; i += 4) {
+        vst1q_f32(dst + i, vaddq_f32(vld1q_f32(dst + i), vld1q_f32(src + i)));
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i] += src[i];
+    }
+}
+
+// IEEE half precision conversions.  EncodeHalf() rounds to nearest even.
+// DecodeHalf() scales the shifted exponent and mantissa bits by 2^112, which
+// also handles denormals, then patches up infinities and NaNs.
+inline uint16_t EncodeHalf(
+    float value)
+{
+    uint32_t u;
+    memcpy(&u, &value, sizeof(u));
+    auto sign = u & 0x80000000u;
+    u ^= sign;
+
+    uint32_t h;
+    if (u >= (143u << 23)) {                // Overflows to infinity, or NaN
+        h = u > (255u << 23) ? 0x7e00u : 0x7c00u;
+    } else if (u < (113u << 23)) {          // Denormal or zero
+        uint32_t const denormMagicBits = 126u << 23;
+        float denormMagic = 0.f;
+        memcpy(&denormMagic, &denormMagicBits, sizeof(denormMagic));
+        float f = 0.f;
+        memcpy(&f, &u, sizeof(f));
+        f += denormMagic;
+        memcpy(&h, &f, sizeof(h));
+        h -= denormMagicBits;
+    } else {
+        auto mantissaOdd = (u >> 13) & 1u;
+        u += (uint32_t) (15 - 127) * (1u << 23) + 0xfffu + mantissaOdd;
+        h = u >> 13;
+    }
+    return (uint16_t) (h | (sign >> 16));
+}
+
+inline float DecodeHalf(
+    uint16_t value)
+{
+    uint32_t u = (uint32_t) (value & 0x7fffu) << 13;
+    float f = 0.f;
+    memcpy(&f, &u, sizeof(f));
+    f *= 5.192296858534828e33f;             // 2^112
+    memcpy(&u, &f, sizeof(u));
+    if (f >= 65536.f) {
+        u |= 255u << 23;
+    }
+    u |= (uint32_t) (value & 0x8000u) << 16;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+inline void DecodeHalf(
+    float* dst,
+    uint16_t const* src,
+    size_t n)
+{
+    size_t i = 0;
+#if defined(METRICS_GUI_AVX2)
+    auto magic = _mm256_set1_ps(5.192296858534828e33f);
+    auto infNan = _mm256_set1_ps(65536.f);
+    auto maxExponent = _mm256_castsi256_ps(_mm256_set1_epi32(255 << 23));
+    for (; i + 8 <= n; i += 8) {
+        auto h = _mm256_cvtepu16_epi32(_mm_loadu_si128((__m128i const*) (src + i)));
+        auto sign = _mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(0x8000)), 16);
+        auto f = _mm256_mul_ps(_mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(0x7fff)), 13)), magic);
+        f = _mm256_or_ps(f, _mm256_and_ps(_mm256_cmp_ps(f, infNan, _CMP_GE_OQ), maxExponent));
+        _mm256_storeu_ps(dst + i, _mm256_or_ps(f, _mm256_castsi256_ps(sign)));
+    }
+#elif defined(METRICS_GUI_SSE2)
+    auto magic = _mm_set1_ps(5.192296858534828e33f);
+    auto infNan = _mm_set1_ps(65536.f);
+    auto maxExponent = _mm_castsi128_ps(_mm_set1_epi32(255 << 23));
+    for (; i + 4 <= n; i += 4) {
+        auto h = _mm_unpacklo_epi16(_mm_loadl_epi64((__m128i const*) (src + i)), _mm_setzero_si128());
+        auto sign = _mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(0x8000)), 16);
+        auto f = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(0x7fff)), 13)), magic);
+        f = _mm_or_ps(f, _mm_and_ps(_mm_cmpge_ps(f, infNan), maxExponent));
+        _mm_storeu_ps(dst + i, _mm_or_ps(f, _mm_castsi128_ps(sign)));
+    }
+#elif defined(METRICS_GUI_NEON)
+    auto magic = vdupq_n_f32(5.192296858534828e33f);
+    auto infNan = vdupq_n_f32(65536.f);
+    auto maxExponent = vdupq_n_u32(255u << 23);
+    for (; i + 4 <= n; i += 4) {
+        auto h = vmovl_u16(vld1_u16(src + i));
+        auto sign = vshlq_n_u32(vandq_u32(h, vdupq_n_u32(0x8000)), 16);
+        auto f = vmulq_f32(vreinterpretq_f32_u32(vshlq_n_u32(vandq_u32(h, vdupq_n_u32(0x7fff)), 13)), magic);
+        auto u = vorrq_u32(vreinterpretq_u32_f32(f), vandq_u32(vcgeq_f32(f, infNan), maxExponent));
+        vst1q_f32(dst + i, vreinterpretq_f32_u32(vorrq_u32(u, sign)));
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i] = DecodeHalf(src[i]);
+    }
+}
+
+// dst[i] = offset + src[i] * scale, used to decode values quantized to a
+// known range.
+inline void DecodeUnorm16(
+    float* dst,
+    uint16_t const* src,
+    size_t n,
+    float offset,
+    float scale)
+{
+    size_t i = 0;
+#if defined(METRICS_GUI_AVX2)
+    auto o = _mm256_set1_ps(offset);
+    auto s = _mm256_set1_ps(scale);
+    for (; i + 8 <= n; i += 8) {
+        auto q = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((__m128i const*) (src + i))));
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(o, _mm256_mul_ps(q, s)));
+    }
+#elif defined(METRICS_GUI_SSE2)
+    auto o = _mm_set1_ps(offset);
+    auto s = _mm_set1_ps(scale);
+    for (; i + 4 <= n; i += 4) {
+        auto q = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64((__m128i const*) (src + i)), _mm_setzero_si128()));
+        _mm_storeu_ps(dst + i, _mm_add_ps(o, _mm_mul_ps(q, s)));
+    }
+#elif defined(METRICS_GUI_NEON)
+    auto o = vdupq_n_f32(offset);
+    auto s = vdupq_n_f32(scale);
+    for (; i + 4 <= n; i += 4) {
+        auto q = vcvtq_f32_u32(vmovl_u16(vld1_u16(src + i)));
+        vst1q_f32(dst + i, vaddq_f32(o, vmulq_f32(q, s)));
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i] = offset + (float) src[i] * scale;
+    }
+}
+
+inline void DecodeUnorm8(
+    float* dst,
+    uint8_t const* src,
+    size_t n,
+    float offset,
+    float scale)
+{
+    size_t i = 0;
+#if defined(METRICS_GUI_AVX2)
+    auto o = _mm256_set1_ps(offset);
+    auto s = _mm256_set1_ps(scale);
+    for (; i + 8 <= n; i += 8) {
+        auto q = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i const*) (src + i))));
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(o, _mm256_mul_ps(q, s)));
+    }
+#elif defined(METRICS_GUI_SSE2)
+    auto o = _mm_set1_ps(offset);
+    auto s = _mm_set1_ps(scale);
+    for (; i + 4 <= n; i += 4) {
+        uint32_t packed;
+        memcpy(&packed, src + i, sizeof(packed));
+        auto zero = _mm_setzero_si128();
+        auto q = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128((int) packed), zero), zero);
+        _mm_storeu_ps(dst + i, _mm_add_ps(o, _mm_mul_ps(_mm_cvtepi32_ps(q), s)));
+    }
+#elif defined(METRICS_GUI_NEON)
+    auto o = vdupq_n_f32(offset);
+    auto s = vdupq_n_f32(scale);
+    for (; i + 8 <= n; i += 8) {
+        auto q = vmovl_u8(vld1_u8(src + i));
+        vst1q_f32(dst + i,     vaddq_f32(o, vmulq_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(q))), s)));
+        vst1q_f32(dst + i + 4, vaddq_f32(o, vmulq_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(q))), s)));
+    }
+#endif
+    for (; i < n; ++i) {
+        dst[i] = offset + (float) src[i] * scale;
+    }
+}
+
+} // namespace MetricsGuiKernels
+
+#endif // ifndef METRICS_GUI_KERNELS_H
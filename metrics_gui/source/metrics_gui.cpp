@@ -26,9 +26,20 @@ SOFTWARE.
 #include "../include/metrics_gui/metrics_gui.h"
 #include "../../portable/countof.h"
 #include "../../portable/snprintf.h"
+#ifndef NOMINMAX
+#define NOMINMAX // perf_timer.h includes windows.h on Windows
+#endif
+#include "../../portable/perf_timer.h"
+#include "kernels.h"
 
 #include <algorithm>
 #include <assert.h>
+#include <math.h>
+#include <atomic>
+#include <functional>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
 
 namespace {
 
@@ -41,6 +52,142 @@ static float const LEGEND_TEXT_VERTICAL_SPACING =  2.f;
 
 uint32_t gConstructedMetricIndex = 0;
 
+// Metric histories are allocated from a shared pool so that many small
+// histories are packed densely instead of each being its own heap
+// allocation.  Sizes are rounded up to a power-of-two size class, and each
+// class carves its blocks out of large, cache-line aligned chunks and
+// recycles freed blocks through an intrusive free list.  Histories larger
+// than the largest size class are allocated directly.
+//
+// History values are allocated from their own pool, separate from the
+// extreme queues, sorted copies and timestamps, so that walking the
+// histories of many metrics reads contiguous memory.
+//
+// Like the rest of MetricsGuiMetric construction, the pools are not thread
+// safe.
+class HistoryPool {
+    enum {
+        MIN_CLASS_LOG2  = 4,    // 16 floats, one cache line
+        MAX_CLASS_LOG2  = 12,   // 4096 floats
+        NUM_CLASSES     = MAX_CLASS_LOG2 - MIN_CLASS_LOG2 + 1,
+        CHUNK_SIZE      = 1u << 14,
+        ALIGNMENT       = 64,
+    };
+
+    struct SizeClass {
+        void* mFreeList;
+        float* mNext;
+        float* mEnd;
+    };
+
+    SizeClass mClasses[NUM_CLASSES];
+    std::vector<void*> mAllocations;
+
+    static uint32_t GetClassIndex(uint32_t size)
+    {
+        uint32_t log2 = MIN_CLASS_LOG2;
+        while ((1u << log2) < size) {
+            ++log2;
+        }
+        return log2 - MIN_CLASS_LOG2;
+    }
+
+    float* AllocateAligned(size_t size)
+    {
+        auto memory = malloc(size * sizeof(float) + ALIGNMENT - 1);
+        if (memory == nullptr) {
+            return nullptr;
+        }
+        mAllocations.emplace_back(memory);
+        return (float*) (((uintptr_t) memory + ALIGNMENT - 1) & ~(uintptr_t) (ALIGNMENT - 1));
+    }
+
+    void FreeAligned(float* p)
+    {
+        for (size_t i = 0, N = mAllocations.size(); i < N; ++i) {
+            auto memory = mAllocations[i];
+            if ((uintptr_t) p - (uintptr_t) memory < ALIGNMENT) {
+                mAllocations[i] = mAllocations.back();
+                mAllocations.pop_back();
+                free(memory);
+                return;
+            }
+        }
+        assert(false);
+    }
+
+public:
+    HistoryPool()
+    {
+        memset(mClasses, 0, sizeof(mClasses));
+    }
+
+    ~HistoryPool()
+    {
+        for (auto memory : mAllocations) {
+            free(memory);
+        }
+    }
+
+    float* Allocate(uint32_t size)
+    {
+        assert(size > 0);
+        if (size > (1u << MAX_CLASS_LOG2)) {
+            return AllocateAligned(size);
+        }
+
+        auto classIndex = GetClassIndex(size);
+        auto sizeClass = &mClasses[classIndex];
+        auto blockSize = 1u << (classIndex + MIN_CLASS_LOG2);
+
+        if (sizeClass->mFreeList != nullptr) {
+            auto block = sizeClass->mFreeList;
+            sizeClass->mFreeList = *(void**) block;
+            return (float*) block;
+        }
+
+        if (sizeClass->mNext == sizeClass->mEnd) {
+            sizeClass->mNext = AllocateAligned(CHUNK_SIZE);
+            if (sizeClass->mNext == nullptr) {
+                sizeClass->mEnd = nullptr;
+                return nullptr;
+            }
+            sizeClass->mEnd = sizeClass->mNext + CHUNK_SIZE;
+        }
+
+        auto block = sizeClass->mNext;
+        sizeClass->mNext += blockSize;
+        return block;
+    }
+
+    void Free(float* p, uint32_t size)
+    {
+        if (p == nullptr) {
+            return;
+        }
+        if (size > (1u << MAX_CLASS_LOG2)) {
+            FreeAligned(p);
+            return;
+        }
+
+        auto sizeClass = &mClasses[GetClassIndex(size)];
+        *(void**) p = sizeClass->mFreeList;
+        sizeClass->mFreeList = p;
+    }
+};
+
+HistoryPool& GetHistoryPool()
+{
+    static HistoryPool pool;
+    return pool;
+}
+
+HistoryPool& GetAuxiliaryPool()
+{
+    static HistoryPool pool;
+    return pool;
+}
+
 int CreateQuantityLabel(
     char* memory,
     size_t memorySize,
@@ -136,88 +283,1461 @@ void DrawQuantityLabel(
     char const* prefix,
     bool useSiUnitPrefix)
 {
-    char s[512] = {};
-    CreateQuantityLabel(s, _countof(s), quantity, units, prefix, useSiUnitPrefix);
-    ImGui::TextUnformatted(s);
+    char s[512] = {};
+    CreateQuantityLabel(s, _countof(s), quantity, units, prefix, useSiUnitPrefix);
+    ImGui::TextUnformatted(s);
+}
+
+// History values are stored as floats, or encoded as one of the HISTORY_*
+// formats.  The UNORM formats map [mKnownMinValue, mKnownMaxValue] onto the
+// full integer range.
+uint32_t GetHistoryStorageSize(
+    uint32_t historySize,
+    uint32_t flags)
+{
+    switch (flags & MetricsGuiMetric::HISTORY_FORMAT_MASK) {
+    case MetricsGuiMetric::HISTORY_FLOAT16:
+    case MetricsGuiMetric::HISTORY_UNORM16: return (historySize + 1) / 2;
+    case MetricsGuiMetric::HISTORY_UNORM8:  return (historySize + 3) / 4;
+    default:                                return historySize;
+    }
+}
+
+float GetUnormScale(
+    MetricsGuiMetric const* metric,
+    float maxCode)
+{
+    auto range = metric->mKnownMaxValue - metric->mKnownMinValue;
+    return range > 0.f ? range / maxCode : 0.f;
+}
+
+uint32_t EncodeUnorm(
+    MetricsGuiMetric const* metric,
+    float value,
+    float maxCode)
+{
+    auto range = metric->mKnownMaxValue - metric->mKnownMinValue;
+    if (!(range > 0.f)) {
+        return 0;
+    }
+    auto code = (value - metric->mKnownMinValue) / range * maxCode + 0.5f;
+    return (uint32_t) ImClamp(code, 0.f, maxCode);
+}
+
+float LoadHistoryValue(
+    MetricsGuiMetric const* metric,
+    uint32_t index)
+{
+    switch (metric->mFlags & MetricsGuiMetric::HISTORY_FORMAT_MASK) {
+    case MetricsGuiMetric::HISTORY_FLOAT16:
+        return MetricsGuiKernels::DecodeHalf(metric->mHistory16[index]);
+    case MetricsGuiMetric::HISTORY_UNORM16:
+        return metric->mKnownMinValue + (float) metric->mHistory16[index] * GetUnormScale(metric, 65535.f);
+    case MetricsGuiMetric::HISTORY_UNORM8:
+        return metric->mKnownMinValue + (float) metric->mHistory8[index] * GetUnormScale(metric, 255.f);
+    default:
+        return metric->mHistory[index];
+    }
+}
+
+// Stores value, and returns the value as it will be read back.
+float StoreHistoryValue(
+    MetricsGuiMetric* metric,
+    uint32_t index,
+    float value)
+{
+    switch (metric->mFlags & MetricsGuiMetric::HISTORY_FORMAT_MASK) {
+    case MetricsGuiMetric::HISTORY_FLOAT16:
+        metric->mHistory16[index] = MetricsGuiKernels::EncodeHalf(value);
+        break;
+    case MetricsGuiMetric::HISTORY_UNORM16:
+        metric->mHistory16[index] = (uint16_t) EncodeUnorm(metric, value, 65535.f);
+        break;
+    case MetricsGuiMetric::HISTORY_UNORM8:
+        metric->mHistory8[index] = (uint8_t) EncodeUnorm(metric, value, 255.f);
+        break;
+    default:
+        metric->mHistory[index] = value;
+        return value;
+    }
+    return LoadHistoryValue(metric, index);
+}
+
+// Monotonic queue operations.  The queue holds the indices of the history
+// values that are more extreme than all newer values, oldest first, so the
+// front of the queue is the extreme of the whole history.  supersedes(a, b)
+// returns true if a newer value a makes an older value b redundant.
+template<typename Supersedes>
+void PushExtreme(
+    MetricsGuiExtremeQueue* queue,
+    MetricsGuiMetric const* metric,
+    uint32_t index,
+    Supersedes supersedes)
+{
+    auto historySize = metric->mHistorySize;
+    auto value = LoadHistoryValue(metric, index);
+    while (queue->mCount > 0) {
+        auto back = queue->mIndices[(queue->mHead + queue->mCount - 1) % historySize];
+        if (!supersedes(value, LoadHistoryValue(metric, back))) {
+            break;
+        }
+        queue->mCount -= 1;
+    }
+    queue->mIndices[(queue->mHead + queue->mCount) % historySize] = index;
+    queue->mCount += 1;
+}
+
+void EvictExtreme(
+    MetricsGuiExtremeQueue* queue,
+    uint32_t historySize,
+    uint32_t index)
+{
+    if (queue->mCount > 0 && queue->mIndices[queue->mHead] == index) {
+        queue->mHead = queue->mHead + 1 == historySize ? 0 : queue->mHead + 1;
+        queue->mCount -= 1;
+    }
+}
+
+// Scratch memory used while updating and drawing plots, which only happens
+// on the ImGui thread.
+float* GetScratchBuffer(
+    size_t size)
+{
+    static std::vector<float> scratch;
+    if (scratch.size() < size) {
+        scratch.resize(size);
+    }
+    return scratch.data();
+}
+
+// The metric's flags must still describe the current history's format, and
+// be set to format by the caller afterwards.
+void AllocateHistory(
+    MetricsGuiMetric* metric,
+    uint32_t historySize,
+    uint32_t format,
+    bool sorted,
+    bool timestamps)
+{
+    auto& historyPool = GetHistoryPool();
+    auto& pool = GetAuxiliaryPool();
+    auto oldFormat = metric->mFlags & MetricsGuiMetric::HISTORY_FORMAT_MASK;
+    if (metric->mHistorySize != historySize || oldFormat != format) {
+        historyPool.Free(metric->mHistory, GetHistoryStorageSize(metric->mHistorySize, oldFormat));
+        pool.Free((float*) metric->mMinQueue.mIndices, metric->mHistorySize);
+        pool.Free((float*) metric->mMaxQueue.mIndices, metric->mHistorySize);
+        pool.Free(metric->mSortedHistory, metric->mHistorySize);
+        pool.Free((float*) metric->mTimestamps, 2 * metric->mHistorySize);
+        metric->mHistory = historySize == 0 ? nullptr : historyPool.Allocate(GetHistoryStorageSize(historySize, format));
+        metric->mMinQueue.mIndices = historySize == 0 ? nullptr : (uint32_t*) pool.Allocate(historySize);
+        metric->mMaxQueue.mIndices = historySize == 0 ? nullptr : (uint32_t*) pool.Allocate(historySize);
+        metric->mSortedHistory = nullptr;
+        metric->mTimestamps = nullptr;
+        metric->mHistorySize = historySize;
+    }
+
+    if (sorted != (metric->mSortedHistory != nullptr)) {
+        if (sorted) {
+            metric->mSortedHistory = pool.Allocate(historySize);
+        } else {
+            pool.Free(metric->mSortedHistory, historySize);
+            metric->mSortedHistory = nullptr;
+        }
+    }
+
+    // Timestamps are 64-bit, so take two floats each
+    if (timestamps != (metric->mTimestamps != nullptr)) {
+        if (timestamps) {
+            metric->mTimestamps = (uint64_t*) pool.Allocate(2 * historySize);
+        } else {
+            pool.Free((float*) metric->mTimestamps, 2 * historySize);
+            metric->mTimestamps = nullptr;
+        }
+    }
+}
+
+// Replace oldValue with newValue in a sorted array with count elements, or
+// insert newValue if insert is true, moving only the elements between the
+// two positions.
+void UpdateSortedValues(
+    float* sorted,
+    uint32_t count,
+    float oldValue,
+    float newValue,
+    bool insert)
+{
+    auto end = sorted + count;
+    auto dst = std::upper_bound(sorted, end, newValue);
+    if (insert) {
+        memmove(dst + 1, dst, (end - dst) * sizeof(float));
+        *dst = newValue;
+        return;
+    }
+
+    auto src = std::lower_bound(sorted, end, oldValue);
+    assert(src != end);
+    if (dst > src) {
+        dst -= 1;
+        memmove(src, src + 1, (dst - src) * sizeof(float));
+    } else {
+        memmove(dst + 1, dst, (src - dst) * sizeof(float));
+    }
+    *dst = newValue;
+}
+
+// Sum of history values in [begin, end), ordered oldest to newest.
+float SumHistoryRange(
+    MetricsGuiHistoryView const& history,
+    uint32_t begin,
+    uint32_t end)
+{
+    float v = 0.f;
+    for (uint32_t s = 0; s < 2 && begin < end; ++s) {
+        auto count = history.mSpanCount[s];
+        if (begin < count) {
+            auto spanEnd = std::min(end, count);
+            v += MetricsGuiKernels::ReduceSum(history.mSpan[s] + begin, spanEnd - begin);
+        }
+        begin = begin < count ? 0 : begin - count;
+        end   = end   < count ? 0 : end   - count;
+    }
+    return v;
+}
+
+void MergeAggregate(
+    MetricsGuiAggregate* dst,
+    MetricsGuiAggregate const& src)
+{
+    if (dst->mCount == 0) {
+        *dst = src;
+        return;
+    }
+    dst->mMin = std::min(dst->mMin, src.mMin);
+    dst->mMax = std::max(dst->mMax, src.mMax);
+    dst->mSum += src.mSum;
+    dst->mCount += src.mCount;
+}
+
+// Add a value to the finest tier.  Each bucket completed in a tier is
+// merged into the next coarser tier, so coarser tiers are touched
+// proportionally less often.
+void RollUpHistoryTiers(
+    std::vector<MetricsGuiHistoryTier>* tiers,
+    float value)
+{
+    MetricsGuiAggregate aggregate = { value, value, value, 1 };
+    for (auto& tier : *tiers) {
+        MergeAggregate(&tier.mPending, aggregate);
+        if (tier.mPending.mCount < tier.mSamplesPerBucket) {
+            break;
+        }
+
+        aggregate = tier.mPending;
+        tier.mPending = MetricsGuiAggregate();
+        tier.mBuckets[tier.mBucketHead] = aggregate;
+        tier.mBucketHead = tier.mBucketHead + 1 == tier.mBuckets.size() ? 0 : tier.mBucketHead + 1;
+        tier.mBucketCount = std::min((uint32_t) tier.mBuckets.size(), tier.mBucketCount + 1);
+    }
+}
+
+// Plots spanning more values than a metric's history draw from its finest
+// tier that spans them in at most maxBucketCount buckets, or from its
+// coarsest tier if none can.  Returns nullptr if the history itself spans
+// length values or there are no tiers.
+MetricsGuiHistoryTier const* SelectHistoryTier(
+    MetricsGuiMetric const* metric,
+    uint32_t length,
+    uint32_t maxBucketCount)
+{
+    if (length <= metric->mHistorySize || metric->mTiers.empty()) {
+        return nullptr;
+    }
+    for (auto const& tier : metric->mTiers) {
+        auto bucketCount = (length + tier.mSamplesPerBucket - 1) / tier.mSamplesPerBucket;
+        if (bucketCount <= maxBucketCount && bucketCount <= tier.mBuckets.size() + 1) {
+            return &tier;
+        }
+    }
+    return &metric->mTiers.back();
+}
+
+// Number of the newest buckets of tier, including the pending one, that
+// span up to length values.
+uint32_t GetTierBucketCount(
+    MetricsGuiHistoryTier const* tier,
+    uint32_t length)
+{
+    auto available = tier->mBucketCount + (tier->mPending.mCount > 0 ? 1 : 0);
+    return std::min(available, (length + tier->mSamplesPerBucket - 1) / tier->mSamplesPerBucket);
+}
+
+// Plots spanning more values than a metric's history draw the newest
+// archived values they span if the metric has no tiers, or if they have
+// room for every value.  Returns the number of archived values drawn.
+uint32_t GetPlotArchiveCount(
+    MetricsGuiMetric const* metric,
+    uint32_t length,
+    uint32_t maxValueCount)
+{
+    if (metric->mArchive == nullptr || length <= metric->mHistorySize) {
+        return 0;
+    }
+    if (!metric->mTiers.empty() && length > maxValueCount) {
+        return 0;
+    }
+    return std::min(length - metric->mHistorySize, metric->mArchive->GetValueCount());
+}
+
+// The values a metric contributes to a history plot: its newest history
+// values, optionally preceded by archived values, or the averages of the
+// newest buckets of one of its tiers.
+struct PlotSeries {
+    MetricsGuiHistoryView mValues;  // Ordered from oldest to newest
+    uint32_t mSamplesPerValue;
+    uint32_t mHistoryBegin;         // Index of the first value that is in the metric's history
+    uint32_t mHistoryOffset;        // GetHistory() index of that value
+    float const* mMinValues;        // Extremes of the samples each value averages, if mSamplesPerValue > 1
+    float const* mMaxValues;
+};
+
+PlotSeries GetPlotSeries(
+    MetricsGuiMetric const* metric,
+    uint32_t length,
+    uint32_t maxValueCount)
+{
+    PlotSeries series;
+    auto archiveCount = GetPlotArchiveCount(metric, length, maxValueCount);
+    if (archiveCount > 0) {
+        // Read the archive in runs of about as many values as a pixel
+        // spans, so only the runs' aggregates are read rather than every
+        // value.  Values only enter the archive once the history is full,
+        // so the history continues the archive's runs.
+        auto archive = metric->mArchive;
+        auto history = metric->GetHistory();
+        auto archiveEnd = archive->GetValueCount();
+        auto archiveBegin = archiveEnd - archiveCount;
+        auto valuesPerRun = archive->GetValuesPerRun((length + maxValueCount - 1) / std::max(1u, maxValueCount));
+        auto firstRun = archiveBegin / valuesPerRun;
+        auto runCount = (archiveEnd + history.Size() - 1) / valuesPerRun - firstRun + 1;
+
+        static std::vector<MetricsGuiAggregate> runs;
+        if (runs.size() < runCount) {
+            runs.resize(runCount);
+        }
+        auto archiveRunCount = archive->GetRunAggregates(archiveBegin, archiveEnd, valuesPerRun, runs.data());
+        std::fill(runs.begin() + archiveRunCount, runs.begin() + runCount, MetricsGuiAggregate());
+        auto index = archiveEnd;
+        for (uint32_t span = 0; span < 2; ++span) {
+            for (uint32_t i = 0; i < history.mSpanCount[span]; ++i, ++index) {
+                auto value = history.mSpan[span][i];
+                MetricsGuiAggregate aggregate = { value, value, value, 1 };
+                MergeAggregate(&runs[index / valuesPerRun - firstRun], aggregate);
+            }
+        }
+
+        auto values = GetScratchBuffer(3 * runCount);
+        auto minValues = values + runCount;
+        auto maxValues = minValues + runCount;
+        for (uint32_t i = 0; i < runCount; ++i) {
+            values[i] = runs[i].mSum / (float) runs[i].mCount;
+            minValues[i] = runs[i].mMin;
+            maxValues[i] = runs[i].mMax;
+        }
+        series.mValues.mSpan[0] = values;
+        series.mValues.mSpan[1] = values + runCount;
+        series.mValues.mSpanCount[0] = runCount;
+        series.mValues.mSpanCount[1] = 0;
+        series.mSamplesPerValue = valuesPerRun;
+        series.mHistoryBegin = runCount;
+        series.mHistoryOffset = 0;
+        series.mMinValues = minValues;
+        series.mMaxValues = maxValues;
+        return series;
+    }
+
+    auto tier = SelectHistoryTier(metric, length, maxValueCount);
+    if (tier == nullptr) {
+        // Drop the oldest values that don't fit in the plot
+        series.mValues = metric->GetHistory();
+        series.mSamplesPerValue = 1;
+        auto dropCount = metric->mHistorySize - std::min(metric->mHistorySize, length);
+        auto spanDropCount = std::min(dropCount, series.mValues.mSpanCount[0]);
+        series.mValues.mSpan[0] += spanDropCount;
+        series.mValues.mSpanCount[0] -= spanDropCount;
+        series.mValues.mSpan[1] += dropCount - spanDropCount;
+        series.mValues.mSpanCount[1] -= dropCount - spanDropCount;
+        series.mHistoryBegin = 0;
+        series.mHistoryOffset = dropCount;
+        series.mMinValues = nullptr;
+        series.mMaxValues = nullptr;
+        return series;
+    }
+
+    auto bucketCount = GetTierBucketCount(tier, length);
+    auto firstBucket = tier->mBucketCount + (tier->mPending.mCount > 0 ? 1 : 0) - bucketCount;
+    auto values = GetScratchBuffer(3 * bucketCount);
+    auto minValues = values + bucketCount;
+    auto maxValues = minValues + bucketCount;
+    for (uint32_t i = 0; i < bucketCount; ++i) {
+        auto const& bucket = tier->GetBucket(firstBucket + i);
+        values[i] = bucket.mSum / (float) bucket.mCount;
+        minValues[i] = bucket.mMin;
+        maxValues[i] = bucket.mMax;
+    }
+    series.mValues.mSpan[0] = values;
+    series.mValues.mSpan[1] = values + bucketCount;
+    series.mValues.mSpanCount[0] = bucketCount;
+    series.mValues.mSpanCount[1] = 0;
+    series.mSamplesPerValue = tier->mSamplesPerBucket;
+    series.mHistoryBegin = bucketCount;
+    series.mHistoryOffset = 0;
+    series.mMinValues = minValues;
+    series.mMaxValues = maxValues;
+    return series;
+}
+
+// Get the extremes of series values [begin, end), from the tier bucket
+// extremes, the metric's extreme tree, or the values themselves.
+void GetSeriesExtremes(
+    MetricsGuiMetric const* metric,
+    PlotSeries const& series,
+    uint32_t begin,
+    uint32_t end,
+    float* minValue,
+    float* maxValue)
+{
+    *minValue = FLT_MAX;
+    *maxValue = -FLT_MAX;
+    if (series.mMinValues != nullptr) {
+        for (auto i = begin; i < end; ++i) {
+            *minValue = std::min(*minValue, series.mMinValues[i]);
+            *maxValue = std::max(*maxValue, series.mMaxValues[i]);
+        }
+        return;
+    }
+
+    auto historyBegin = std::min(std::max(series.mHistoryBegin, begin), end);
+    for (auto i = begin; i < historyBegin; ++i) {
+        *minValue = std::min(*minValue, series.mValues[i]);
+        *maxValue = std::max(*maxValue, series.mValues[i]);
+    }
+    if (historyBegin < end) {
+        float historyMinValue;
+        float historyMaxValue;
+        metric->GetHistoryRangeExtremes(
+            historyBegin - series.mHistoryBegin + series.mHistoryOffset,
+            end - series.mHistoryBegin + series.mHistoryOffset,
+            &historyMinValue,
+            &historyMaxValue);
+        *minValue = std::min(*minValue, historyMinValue);
+        *maxValue = std::max(*maxValue, historyMaxValue);
+    }
+}
+
+// The metrics drawn together by a plot: all of its metrics, or a single
+// metric's inline graph.
+struct MetricRange {
+    MetricsGuiMetric* const* mMetrics;
+    size_t mCount;
+
+    MetricRange(
+        std::vector<MetricsGuiMetric*> const& metrics)
+        : mMetrics(metrics.data())
+        , mCount(metrics.size())
+    {
+    }
+
+    MetricRange(
+        MetricsGuiMetric* const* metrics,
+        size_t count)
+        : mMetrics(metrics)
+        , mCount(count)
+    {
+    }
+
+    MetricsGuiMetric* const* begin() const { return mMetrics; }
+    MetricsGuiMetric* const* end() const { return mMetrics + mCount; }
+    size_t size() const { return mCount; }
+    MetricsGuiMetric* operator[](size_t i) const { return mMetrics[i]; }
+};
+
+// The number of values spanned by the history plots of plot.
+uint32_t GetPlotHistoryLength(
+    MetricsGuiPlot const* plot,
+    MetricRange metrics)
+{
+    if (plot->mHistoryLength > 0) {
+        return plot->mHistoryLength;
+    }
+    uint32_t historySize = 0;
+    for (auto metric : metrics) {
+        historySize = std::max(historySize, metric->mHistorySize);
+    }
+    return historySize;
+}
+
+void AddKey(
+    std::vector<uint32_t>* key,
+    float value)
+{
+    uint32_t bits = 0;
+    memcpy(&bits, &value, sizeof(bits));
+    key->emplace_back(bits);
+}
+
+// Move value towards target by dampening, onto target once it is within
+// tolerance, so that a settled axis stops changing.
+float DampenTowards(
+    float value,
+    float target,
+    float oldWeight,
+    float tolerance)
+{
+    value = value * oldWeight + target * (1.f - oldWeight);
+    return fabsf(value - target) <= tolerance ? target : value;
+}
+
+} // anon namespace
+
+// Bounded multi-producer, single-consumer queue.  Each cell carries a
+// sequence number that tells a producer whether the cell is free for
+// position pos (sequence == pos) and tells the consumer whether it has been
+// written (sequence == pos + 1).  Producers claim a position with a CAS, so
+// they never block on each other or on the consumer.  The fields written by
+// producers and by the consumer are on separate cache lines.
+struct MetricsGuiStagingQueue {
+    struct Cell {
+        std::atomic<uint32_t> mSequence;
+        float mValue;
+        uint64_t mTimestamp;                // GetPerfTimerCount() when pushed, if TRACK_TIMESTAMPS
+    };
+
+    Cell* mCells;
+    uint32_t mMask;
+    char mPad0[64];
+    std::atomic<uint32_t> mEnqueuePos;      // Written by producers
+    std::atomic<uint64_t> mDroppedCount;
+    char mPad1[64];
+    uint32_t mDequeuePos;                   // Written by the consumer
+    char mPad2[64];
+
+    explicit MetricsGuiStagingQueue(uint32_t size)
+    {
+        uint32_t cellCount = 2;
+        while (cellCount < size) {
+            cellCount <<= 1;
+        }
+
+        mCells = new Cell[cellCount];
+        mMask = cellCount - 1;
+        for (uint32_t i = 0; i < cellCount; ++i) {
+            mCells[i].mSequence.store(i, std::memory_order_relaxed);
+        }
+        mEnqueuePos.store(0, std::memory_order_relaxed);
+        mDequeuePos = 0;
+        mDroppedCount.store(0, std::memory_order_relaxed);
+    }
+
+    ~MetricsGuiStagingQueue()
+    {
+        delete[] mCells;
+    }
+
+    bool Push(float value, uint64_t timestamp)
+    {
+        auto pos = mEnqueuePos.load(std::memory_order_relaxed);
+        for (;;) {
+            auto cell = &mCells[pos & mMask];
+            auto seq = cell->mSequence.load(std::memory_order_acquire);
+            auto diff = (int32_t) (seq - pos);
+            if (diff == 0) {
+                if (mEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell->mValue = value;
+                    cell->mTimestamp = timestamp;
+                    cell->mSequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                mDroppedCount.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            } else {
+                pos = mEnqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool Pop(float* value, uint64_t* timestamp)
+    {
+        auto cell = &mCells[mDequeuePos & mMask];
+        auto seq = cell->mSequence.load(std::memory_order_acquire);
+        if ((int32_t) (seq - (mDequeuePos + 1)) < 0) {
+            return false;
+        }
+        *value = cell->mValue;
+        *timestamp = cell->mTimestamp;
+        cell->mSequence.store(mDequeuePos + mMask + 1, std::memory_order_release);
+        mDequeuePos += 1;
+        return true;
+    }
+};
+
+// The vertices and indices of a plot's series, and the key of everything
+// they were tessellated from.
+struct MetricsGuiPlotGeometry {
+    std::vector<uint32_t> mKey;
+    ImVector<ImDrawVert> mVertices;         // Relative to the top-left of the plot
+    ImVector<ImDrawIdx> mIndices;           // Relative to the first vertex
+};
+
+// Memory for the temporaries of a plot's draw calls.  Allocations are
+// released together by the FrameArenaScope they were made in, and blocks
+// are kept for later draws, so drawing stops allocating once the blocks have
+// grown to fit the plot.  Each plot has its own arena, so plots drawn in
+// different ImGui contexts or threads don't release each other's memory.
+struct MetricsGuiFrameArena {
+    enum { MIN_BLOCK_SIZE = 4 * 1024 };
+
+    std::vector<std::vector<char>> mBlocks;
+    size_t mBlock;                          // Index of the block being allocated from
+    size_t mOffset;                         // Bytes of that block in use
+
+    MetricsGuiFrameArena()
+        : mBlock(0)
+        , mOffset(0)
+    {
+    }
+
+    void* Allocate(
+        size_t size,
+        size_t alignment)
+    {
+        auto offset = (mOffset + alignment - 1) & ~(alignment - 1);
+        if (mBlock == mBlocks.size() || offset + size > mBlocks[mBlock].size()) {
+            // Move to the next block, growing it if it is too small.  Blocks
+            // after the current one are not in use.
+            auto next = mBlock == mBlocks.size() ? mBlock : mBlock + 1;
+            if (next == mBlocks.size()) {
+                mBlocks.emplace_back();
+            }
+            if (mBlocks[next].size() < size) {
+                auto blockSize = std::max(size, (size_t) MIN_BLOCK_SIZE);
+                if (next > 0) {
+                    blockSize = std::max(blockSize, 2 * mBlocks[next - 1].size());
+                }
+                mBlocks[next].assign(blockSize, 0);
+            }
+            mBlock = next;
+            offset = 0;
+        }
+        mOffset = offset + size;
+        return mBlocks[mBlock].data() + offset;
+    }
+};
+
+namespace {
+
+// Releases the frame arena memory allocated during its lifetime.
+struct FrameArenaScope {
+    MetricsGuiFrameArena* mArena;
+    size_t mBlock;
+    size_t mOffset;
+
+    explicit FrameArenaScope(
+        MetricsGuiFrameArena* arena)
+        : mArena(arena)
+        , mBlock(arena->mBlock)
+        , mOffset(arena->mOffset)
+    {
+    }
+
+    ~FrameArenaScope()
+    {
+        mArena->mBlock = mBlock;
+        mArena->mOffset = mOffset;
+    }
+};
+
+// Allocate an uninitialized array from a frame arena.  T must be trivially
+// destructible, as the array is released without destroying it.
+template<typename T>
+T* AllocateFrameArray(
+    MetricsGuiFrameArena* arena,
+    size_t count)
+{
+    return static_cast<T*>(arena->Allocate(count * sizeof(T), alignof(T)));
+}
+
+} // anon namespace
+
+// The minimum and maximum of each block of BLOCK_SIZE values in the
+// history's storage, and of each pair of nodes above them in a binary tree.
+// Node 1 is the root, and block i is node mLeafCount + i.
+struct MetricsGuiExtremeTree {
+    enum { BLOCK_SIZE = 16 };
+
+    std::vector<float> mMin;
+    std::vector<float> mMax;
+    uint32_t mLeafCount;
+
+    explicit MetricsGuiExtremeTree(
+        MetricsGuiMetric const* metric)
+    {
+        auto blockCount = (metric->mHistorySize + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        mLeafCount = 1;
+        while (mLeafCount < blockCount) {
+            mLeafCount *= 2;
+        }
+        mMin.assign(2 * mLeafCount, FLT_MAX);
+        mMax.assign(2 * mLeafCount, -FLT_MAX);
+        for (uint32_t i = 0; i < blockCount; ++i) {
+            UpdateBlock(metric, i);
+        }
+        for (auto node = mLeafCount - 1; node > 0; --node) {
+            mMin[node] = std::min(mMin[2 * node], mMin[2 * node + 1]);
+            mMax[node] = std::max(mMax[2 * node], mMax[2 * node + 1]);
+        }
+    }
+
+    void UpdateBlock(
+        MetricsGuiMetric const* metric,
+        uint32_t block)
+    {
+        auto minValue = FLT_MAX;
+        auto maxValue = -FLT_MAX;
+        for (auto i = block * BLOCK_SIZE, end = std::min(i + BLOCK_SIZE, metric->mHistorySize); i < end; ++i) {
+            auto value = LoadHistoryValue(metric, i);
+            minValue = std::min(minValue, value);
+            maxValue = std::max(maxValue, value);
+        }
+        mMin[mLeafCount + block] = minValue;
+        mMax[mLeafCount + block] = maxValue;
+    }
+
+    // Update the tree after the history value at index changed.
+    void Update(
+        MetricsGuiMetric const* metric,
+        uint32_t index)
+    {
+        auto block = index / BLOCK_SIZE;
+        UpdateBlock(metric, block);
+        for (auto node = (mLeafCount + block) / 2; node > 0; node /= 2) {
+            auto minValue = std::min(mMin[2 * node], mMin[2 * node + 1]);
+            auto maxValue = std::max(mMax[2 * node], mMax[2 * node + 1]);
+            if (minValue == mMin[node] && maxValue == mMax[node]) {
+                break;
+            }
+            mMin[node] = minValue;
+            mMax[node] = maxValue;
+        }
+    }
+
+    // Include the values of history storage [begin, end) in minValue and
+    // maxValue.  Values of partially covered blocks are read directly.
+    void Query(
+        MetricsGuiMetric const* metric,
+        uint32_t begin,
+        uint32_t end,
+        float* minValue,
+        float* maxValue) const
+    {
+        for (; begin < end && begin % BLOCK_SIZE != 0; ++begin) {
+            auto value = LoadHistoryValue(metric, begin);
+            *minValue = std::min(*minValue, value);
+            *maxValue = std::max(*maxValue, value);
+        }
+        for (; begin < end && end % BLOCK_SIZE != 0 && end != metric->mHistorySize; --end) {
+            auto value = LoadHistoryValue(metric, end - 1);
+            *minValue = std::min(*minValue, value);
+            *maxValue = std::max(*maxValue, value);
+        }
+        if (begin == end) {
+            return;
+        }
+
+        auto l = mLeafCount + begin / BLOCK_SIZE;
+        auto r = mLeafCount + (end + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        for (; l < r; l /= 2, r /= 2) {
+            if (l & 1) {
+                *minValue = std::min(*minValue, mMin[l]);
+                *maxValue = std::max(*maxValue, mMax[l]);
+                ++l;
+            }
+            if (r & 1) {
+                --r;
+                *minValue = std::min(*minValue, mMin[r]);
+                *maxValue = std::max(*maxValue, mMax[r]);
+            }
+        }
+    }
+};
+
+MetricsGuiMetric::MetricsGuiMetric()
+    : mHistory(nullptr)
+    , mHistorySize(0)
+    , mFlags(0)
+    , mMinQueue()
+    , mMaxQueue()
+    , mGeneration(0)
+    , mSortedHistory(nullptr)
+    , mTimestamps(nullptr)
+    , mStagingQueue(nullptr)
+    , mArchive(nullptr)
+    , mExtremeTree(nullptr)
+{
+    auto c = ImColor::HSV(0.2f * gConstructedMetricIndex++, 0.8f, 0.8f);
+    mColor[0] = c.Value.x;
+    mColor[1] = c.Value.y;
+    mColor[2] = c.Value.z;
+    mColor[3] = c.Value.w;
+
+    Initialize("", "", NONE);
+}
+
+MetricsGuiMetric::MetricsGuiMetric(
+    char const* description,
+    char const* units,
+    uint32_t flags,
+    uint32_t historySize)
+    : mHistory(nullptr)
+    , mHistorySize(0)
+    , mFlags(0)
+    , mMinQueue()
+    , mMaxQueue()
+    , mGeneration(0)
+    , mSortedHistory(nullptr)
+    , mTimestamps(nullptr)
+    , mStagingQueue(nullptr)
+    , mArchive(nullptr)
+    , mExtremeTree(nullptr)
+{
+    auto c = ImColor::HSV(0.2f * gConstructedMetricIndex++, 0.8f, 0.8f);
+    mColor[0] = c.Value.x;
+    mColor[1] = c.Value.y;
+    mColor[2] = c.Value.z;
+    mColor[3] = c.Value.w;
+
+    Initialize(description, units, flags, historySize);
+}
+
+MetricsGuiMetric::MetricsGuiMetric(
+    MetricsGuiMetric const& copy)
+    : mHistory(nullptr)
+    , mHistorySize(0)
+    , mFlags(0)
+    , mMinQueue()
+    , mMaxQueue()
+    , mGeneration(0)
+    , mSortedHistory(nullptr)
+    , mTimestamps(nullptr)
+    , mStagingQueue(nullptr)
+    , mArchive(nullptr)
+    , mExtremeTree(nullptr)
+{
+    *this = copy;
+}
+
+MetricsGuiMetric::~MetricsGuiMetric()
+{
+    AllocateHistory(this, 0, 0, false, false);
+    delete mStagingQueue;
+    delete mArchive;
+    delete mExtremeTree;
+}
+
+MetricsGuiMetric& MetricsGuiMetric::operator=(
+    MetricsGuiMetric const& copy)
+{
+    if (this == &copy) {
+        return *this;
+    }
+
+    AllocateHistory(this, copy.mHistorySize, copy.mFlags & HISTORY_FORMAT_MASK, copy.mSortedHistory != nullptr, copy.mTimestamps != nullptr);
+    memcpy(mHistory, copy.mHistory, GetHistoryStorageSize(mHistorySize, copy.mFlags) * sizeof(float));
+    if (mSortedHistory != nullptr) {
+        memcpy(mSortedHistory, copy.mSortedHistory, mHistorySize * sizeof(float));
+    }
+    if (mTimestamps != nullptr) {
+        memcpy(mTimestamps, copy.mTimestamps, mHistorySize * sizeof(uint64_t));
+    }
+    memcpy(mMinQueue.mIndices, copy.mMinQueue.mIndices, mHistorySize * sizeof(uint32_t));
+    memcpy(mMaxQueue.mIndices, copy.mMaxQueue.mIndices, mHistorySize * sizeof(uint32_t));
+
+    mDescription    = copy.mDescription;
+    mUnits          = copy.mUnits;
+    mTotalInHistory = copy.mTotalInHistory;
+    mHistoryCount   = copy.mHistoryCount;
+    mHistoryMinValue = copy.mHistoryMinValue;
+    mHistoryMaxValue = copy.mHistoryMaxValue;
+    mHistoryHead    = copy.mHistoryHead;
+    mMinQueue.mHead  = copy.mMinQueue.mHead;
+    mMinQueue.mCount = copy.mMinQueue.mCount;
+    mMaxQueue.mHead  = copy.mMaxQueue.mHead;
+    mMaxQueue.mCount = copy.mMaxQueue.mCount;
+    mExtremesDirty  = copy.mExtremesDirty;
+    mKnownMinValue  = copy.mKnownMinValue;
+    mKnownMaxValue  = copy.mKnownMaxValue;
+    mFlags          = copy.mFlags;
+    mSelected       = copy.mSelected;
+    mGeneration    += 1;
+    mHistogram      = copy.mHistogram;
+    mTiers          = copy.mTiers;
+    memcpy(mColor, copy.mColor, sizeof(mColor));
+
+    delete mArchive;
+    mArchive = copy.mArchive == nullptr
+        ? nullptr
+        : new MetricsGuiHistoryArchive(*copy.mArchive);
+
+    // The extreme tree is rebuilt when next needed
+    delete mExtremeTree;
+    mExtremeTree = nullptr;
+
+    // Staged values are not copied, only the ability to stage them
+    delete mStagingQueue;
+    mStagingQueue = copy.mStagingQueue == nullptr
+        ? nullptr
+        : new MetricsGuiStagingQueue(copy.mStagingQueue->mMask + 1);
+    return *this;
+}
+
+void MetricsGuiMetric::Initialize(
+    char const* description,
+    char const* units,
+    uint32_t flags,
+    uint32_t historySize)
+{
+    assert(historySize > 0);
+    assert((flags & HISTORY_FORMAT_MASK) == 0 || ((flags & HISTORY_FORMAT_MASK) & ((flags & HISTORY_FORMAT_MASK) - 1)) == 0);
+    AllocateHistory(this, historySize, flags & HISTORY_FORMAT_MASK, (flags & TRACK_PERCENTILES) != 0, (flags & TRACK_TIMESTAMPS) != 0);
+
+    mDescription = MetricsGuiRegistry::Intern(description == nullptr ? "" : description);
+    mUnits = MetricsGuiRegistry::Intern(units == nullptr ? "" : units);
+    mTotalInHistory = 0.;
+    mHistoryCount = 0;
+    mHistoryHead = 0;
+    mExtremesDirty = true;
+    memset(mHistory, 0, GetHistoryStorageSize(mHistorySize, flags) * sizeof(float));
+    if (mTimestamps != nullptr) {
+        memset(mTimestamps, 0, mHistorySize * sizeof(uint64_t));
+    }
+    mKnownMinValue = 0.f;
+    mKnownMaxValue = 0.f;
+    mFlags = flags;
+    mSelected = false;
+    mGeneration += 1;
+    mHistogram.mCounts.clear();
+    mHistogram.mEdges.clear();
+    mTiers.clear();
+    delete mArchive;
+    mArchive = nullptr;
+    delete mExtremeTree;
+    mExtremeTree = nullptr;
+}
+
+void MetricsGuiMetric::ClearHistory()
+{
+    mTotalInHistory = 0.;
+    mHistoryCount = 0;
+    mHistoryHead = 0;
+    mHistoryMinValue = 0.f;
+    mHistoryMaxValue = 0.f;
+    mExtremesDirty = true;
+    memset(mHistory, 0, GetHistoryStorageSize(mHistorySize, mFlags) * sizeof(float));
+    if (mTimestamps != nullptr) {
+        memset(mTimestamps, 0, mHistorySize * sizeof(uint64_t));
+    }
+    mHistogram.mCounts.assign(mHistogram.mCounts.size(), 0);
+    for (auto& tier : mTiers) {
+        tier.mPending = MetricsGuiAggregate();
+        tier.mBucketHead = 0;
+        tier.mBucketCount = 0;
+    }
+    if (mArchive != nullptr) {
+        mArchive->Initialize(mArchive->mValuesPerBlock, (uint32_t) mArchive->mBlocks.size());
+    }
+    delete mExtremeTree;
+    mExtremeTree = nullptr;
+    mGeneration += 1;
+}
+
+void MetricsGuiMetric::SetLastValue(
+    float value,
+    uint32_t prevIndex)
+{
+    assert(prevIndex < mHistorySize);
+    auto index = (mHistoryHead + mHistorySize - 1 - prevIndex) % mHistorySize;
+    auto oldValue = LoadHistoryValue(this, index);
+    value = StoreHistoryValue(this, index, value);
+    if (mExtremeTree != nullptr) {
+        mExtremeTree->Update(this, index);
+    }
+    if (prevIndex < mHistoryCount) {
+        if (mSortedHistory != nullptr) {
+            UpdateSortedValues(mSortedHistory, mHistoryCount, oldValue, value, false);
+        }
+        if (!mHistogram.mCounts.empty()) {
+            mHistogram.mCounts[mHistogram.GetBin(oldValue)] -= 1;
+            mHistogram.mCounts[mHistogram.GetBin(value)] += 1;
+        }
+        mTotalInHistory -= oldValue;
+        mTotalInHistory += value;
+    }
+    mExtremesDirty = true;
+    mGeneration += 1;
+}
+
+void MetricsGuiMetric::AddNewValue(
+    float value)
+{
+    AddNewValue(value, mTimestamps == nullptr ? 0 : GetPerfTimerCount());
+}
+
+void MetricsGuiMetric::AddNewValue(
+    float value,
+    uint64_t timestamp)
+{
+    // The UNORM range must be set by the time the first value is added, so
+    // clear the history to the value nearest zero then, for plots to draw.
+    // Like the zeros of a float history, unfilled values are not part of
+    // mTotalInHistory, the extremes or the percentiles.
+    if (mHistoryCount == 0 && (mFlags & (HISTORY_UNORM16 | HISTORY_UNORM8)) != 0) {
+        for (uint32_t i = 0; i < mHistorySize; ++i) {
+            StoreHistoryValue(this, i, 0.f);
+        }
+        mExtremesDirty = true;
+        delete mExtremeTree;
+        mExtremeTree = nullptr;
+    }
+
+    auto index = mHistoryHead;
+    auto oldValue = LoadHistoryValue(this, index);
+    if (!mExtremesDirty) {
+        EvictExtreme(&mMinQueue, mHistorySize, index);
+        EvictExtreme(&mMaxQueue, mHistorySize, index);
+    }
+    value = StoreHistoryValue(this, index, value);
+    if (mExtremeTree != nullptr) {
+        mExtremeTree->Update(this, index);
+    }
+    if (mSortedHistory != nullptr) {
+        UpdateSortedValues(mSortedHistory, mHistoryCount, oldValue, value, mHistoryCount < mHistorySize);
+    }
+    if (!mHistogram.mCounts.empty()) {
+        if (mHistoryCount == mHistorySize) {
+            mHistogram.mCounts[mHistogram.GetBin(oldValue)] -= 1;
+        }
+        mHistogram.mCounts[mHistogram.GetBin(value)] += 1;
+    }
+    if (mHistoryCount == mHistorySize) {
+        mTotalInHistory -= oldValue;
+    }
+    mTotalInHistory += value;
+    if (mTimestamps != nullptr) {
+        assert(mHistoryCount == 0 || timestamp >= GetTimestamp(mHistorySize - 1));
+        mTimestamps[index] = timestamp;
+    }
+    if (!mExtremesDirty) {
+        PushExtreme(&mMinQueue, this, index, std::less_equal<float>());
+        PushExtreme(&mMaxQueue, this, index, std::greater_equal<float>());
+        mHistoryMinValue = LoadHistoryValue(this, mMinQueue.mIndices[mMinQueue.mHead]);
+        mHistoryMaxValue = LoadHistoryValue(this, mMaxQueue.mIndices[mMaxQueue.mHead]);
+    }
+    if (mArchive != nullptr && mHistoryCount == mHistorySize) {
+        mArchive->AddValue(oldValue);
+    }
+    mHistoryHead = mHistoryHead + 1 == mHistorySize ? 0 : mHistoryHead + 1;
+    mHistoryCount = std::min(mHistorySize, mHistoryCount + 1);
+    mGeneration += 1;
+    if (!mTiers.empty()) {
+        RollUpHistoryTiers(&mTiers, value);
+    }
+}
+
+float MetricsGuiMetric::GetLastValue(
+    uint32_t prevIndex) const
+{
+    assert(prevIndex < mHistorySize);
+    return LoadHistoryValue(this, (mHistoryHead + mHistorySize - 1 - prevIndex) % mHistorySize);
+}
+
+MetricsGuiHistoryView MetricsGuiMetric::GetHistory() const
+{
+    MetricsGuiHistoryView view;
+    auto format = mFlags & HISTORY_FORMAT_MASK;
+    if (format != 0) {
+        // Decode both spans, oldest first, into one buffer
+        thread_local std::vector<float> decoded;
+        if (decoded.size() < mHistorySize) {
+            decoded.resize(mHistorySize);
+        }
+        auto oldCount = mHistorySize - mHistoryHead;
+        switch (format) {
+        case HISTORY_FLOAT16:
+            MetricsGuiKernels::DecodeHalf(decoded.data(), mHistory16 + mHistoryHead, oldCount);
+            MetricsGuiKernels::DecodeHalf(decoded.data() + oldCount, mHistory16, mHistoryHead);
+            break;
+        case HISTORY_UNORM16:
+            MetricsGuiKernels::DecodeUnorm16(decoded.data(), mHistory16 + mHistoryHead, oldCount, mKnownMinValue, GetUnormScale(this, 65535.f));
+            MetricsGuiKernels::DecodeUnorm16(decoded.data() + oldCount, mHistory16, mHistoryHead, mKnownMinValue, GetUnormScale(this, 65535.f));
+            break;
+        case HISTORY_UNORM8:
+            MetricsGuiKernels::DecodeUnorm8(decoded.data(), mHistory8 + mHistoryHead, oldCount, mKnownMinValue, GetUnormScale(this, 255.f));
+            MetricsGuiKernels::DecodeUnorm8(decoded.data() + oldCount, mHistory8, mHistoryHead, mKnownMinValue, GetUnormScale(this, 255.f));
+            break;
+        }
+        view.mSpan[0] = decoded.data();
+        view.mSpan[1] = decoded.data() + mHistorySize;
+        view.mSpanCount[0] = mHistorySize;
+        view.mSpanCount[1] = 0;
+        return view;
+    }
+
+    view.mSpan[0] = mHistory + mHistoryHead;
+    view.mSpan[1] = mHistory;
+    view.mSpanCount[0] = mHistorySize - mHistoryHead;
+    view.mSpanCount[1] = mHistoryHead;
+    return view;
+}
+
+uint32_t MetricsGuiMetric::FindHistoryIndex(
+    uint64_t timestamp) const
+{
+    assert(mTimestamps != nullptr);
+    auto begin = mHistorySize - mHistoryCount;
+    auto end = mHistorySize;
+    while (begin < end) {
+        auto mid = begin + (end - begin) / 2;
+        if (GetTimestamp(mid) < timestamp) {
+            begin = mid + 1;
+        } else {
+            end = mid;
+        }
+    }
+    return begin;
+}
+
+uint64_t MetricsGuiMetric::GetTimestamp(
+    uint32_t index) const
+{
+    assert(index < mHistorySize);
+    auto i = mHistoryHead + index;
+    return mTimestamps[i < mHistorySize ? i : i - mHistorySize];
+}
+
+void MetricsGuiMetric::EnableStaging(
+    uint32_t queueSize)
+{
+    delete mStagingQueue;
+    mStagingQueue = new MetricsGuiStagingQueue(queueSize);
+}
+
+bool MetricsGuiMetric::PushValue(
+    float value)
+{
+    assert(mStagingQueue != nullptr);
+    return mStagingQueue->Push(value, (mFlags & TRACK_TIMESTAMPS) == 0 ? 0 : GetPerfTimerCount());
+}
+
+uint32_t MetricsGuiMetric::DrainStagedValues()
+{
+    if (mStagingQueue == nullptr) {
+        return 0;
+    }
+
+    // Drain at most one queue's worth so that busy producers can't keep the
+    // consumer here indefinitely.  Producers read the time before claiming
+    // a cell, so concurrent pushes can be queued slightly out of time order;
+    // timestamps are clamped to keep the history's timestamps ascending.
+    uint32_t count = 0;
+    float value;
+    uint64_t timestamp;
+    while (count <= mStagingQueue->mMask && mStagingQueue->Pop(&value, &timestamp)) {
+        if (mTimestamps != nullptr && mHistoryCount > 0) {
+            timestamp = std::max(timestamp, GetTimestamp(mHistorySize - 1));
+        }
+        AddNewValue(value, timestamp);
+        ++count;
+    }
+    return count;
+}
+
+uint64_t MetricsGuiMetric::GetDroppedValueCount() const
+{
+    return mStagingQueue == nullptr ? 0 : mStagingQueue->mDroppedCount.load(std::memory_order_relaxed);
+}
+
+float MetricsGuiMetric::GetHistoryMinValue() const
+{
+    UpdateExtremes();
+    return mHistoryMinValue;
+}
+
+float MetricsGuiMetric::GetHistoryMaxValue() const
+{
+    UpdateExtremes();
+    return mHistoryMaxValue;
+}
+
+void MetricsGuiMetric::UpdateExtremes() const
+{
+    if (!mExtremesDirty) {
+        return;
+    }
+
+    // Only the values added so far are queued; AddNewValue() never evicts
+    // an unfilled index, since it is not in the queues
+    mMinQueue.mHead = 0;
+    mMinQueue.mCount = 0;
+    mMaxQueue.mHead = 0;
+    mMaxQueue.mCount = 0;
+    for (uint32_t i = mHistorySize - mHistoryCount; i < mHistorySize; ++i) {
+        auto index = mHistoryHead + i < mHistorySize ? mHistoryHead + i : mHistoryHead + i - mHistorySize;
+        PushExtreme(&mMinQueue, this, index, std::less_equal<float>());
+        PushExtreme(&mMaxQueue, this, index, std::greater_equal<float>());
+    }
+    if (mHistoryCount == 0) {
+        mHistoryMinValue = 0.f;
+        mHistoryMaxValue = 0.f;
+    } else {
+        mHistoryMinValue = LoadHistoryValue(this, mMinQueue.mIndices[mMinQueue.mHead]);
+        mHistoryMaxValue = LoadHistoryValue(this, mMaxQueue.mIndices[mMaxQueue.mHead]);
+    }
+    mExtremesDirty = false;
+}
+
+void MetricsGuiMetric::GetHistoryRangeExtremes(
+    uint32_t begin,
+    uint32_t end,
+    float* minValue,
+    float* maxValue) const
+{
+    assert(begin <= end && end <= mHistorySize);
+    if (mExtremeTree == nullptr) {
+        mExtremeTree = new MetricsGuiExtremeTree(this);
+    }
+
+    // The range wraps around the end of the ring buffer if it reaches past
+    // the newest value in storage order
+    *minValue = FLT_MAX;
+    *maxValue = -FLT_MAX;
+    auto wrapIndex = mHistorySize - mHistoryHead;
+    if (begin < wrapIndex) {
+        mExtremeTree->Query(this, mHistoryHead + begin, mHistoryHead + std::min(end, wrapIndex), minValue, maxValue);
+    }
+    if (end > wrapIndex) {
+        mExtremeTree->Query(this, std::max(begin, wrapIndex) - wrapIndex, end - wrapIndex, minValue, maxValue);
+    }
+}
+
+float MetricsGuiMetric::GetPercentileValue(
+    float percentile) const
+{
+    assert(mSortedHistory != nullptr);
+    if (mSortedHistory == nullptr || mHistoryCount == 0) {
+        return 0.f;
+    }
+
+    auto rank = ImClamp(percentile, 0.f, 100.f) * 0.01f * (mHistoryCount - 1);
+    auto i = std::min((uint32_t) rank, mHistoryCount - 1);
+    auto j = std::min(i + 1, mHistoryCount - 1);
+    return mSortedHistory[i] + (mSortedHistory[j] - mSortedHistory[i]) * (rank - (float) i);
+}
+
+float MetricsGuiMetric::GetTailAverageValue(
+    float percentile) const
+{
+    assert(mSortedHistory != nullptr);
+    if (mSortedHistory == nullptr || mHistoryCount == 0) {
+        return 0.f;
+    }
+
+    auto tailCount = (uint32_t) ceilf((100.f - ImClamp(percentile, 0.f, 100.f)) * 0.01f * mHistoryCount);
+    tailCount = ImClamp(tailCount, 1u, mHistoryCount);
+    auto tail = mSortedHistory + mHistoryCount - tailCount;
+    return MetricsGuiKernels::ReduceSum(tail, tailCount) / (float) tailCount;
+}
+
+void MetricsGuiMetric::EnableHistogram(
+    uint32_t binCount,
+    float minValue,
+    float maxValue,
+    MetricsGuiHistogram::Scale scale)
+{
+    mHistogram.Initialize(binCount, minValue, maxValue, scale);
+    for (uint32_t i = 0; i < mHistoryCount; ++i) {
+        mHistogram.mCounts[mHistogram.GetBin(GetLastValue(i))] += 1;
+    }
+}
+
+void MetricsGuiMetric::EnableHistoryTiers(
+    uint32_t const* samplesPerBucket,
+    uint32_t tierCount,
+    uint32_t bucketCount)
+{
+    assert(bucketCount > 0);
+
+    mTiers.resize(tierCount);
+    for (uint32_t i = 0; i < tierCount; ++i) {
+        assert(samplesPerBucket[i] > 0);
+        assert(i == 0 || samplesPerBucket[i] % samplesPerBucket[i - 1] == 0);
+
+        auto& tier = mTiers[i];
+        tier.mBuckets.assign(bucketCount, MetricsGuiAggregate());
+        tier.mPending = MetricsGuiAggregate();
+        tier.mSamplesPerBucket = samplesPerBucket[i];
+        tier.mBucketHead = 0;
+        tier.mBucketCount = 0;
+    }
+    mGeneration += 1;
+}
+
+void MetricsGuiMetric::EnableHistoryArchive(
+    uint32_t valueCount,
+    uint32_t valuesPerBlock)
+{
+    assert(valuesPerBlock > 0);
+
+    // One more block than needed, since the newest block is partially filled
+    if (mArchive == nullptr) {
+        mArchive = new MetricsGuiHistoryArchive();
+    }
+    mArchive->Initialize(valuesPerBlock, (valueCount + valuesPerBlock - 1) / valuesPerBlock + 1);
+    mGeneration += 1;
 }
 
-} // anon namespace
+MetricsGuiAggregate const& MetricsGuiHistoryTier::GetBucket(
+    uint32_t i) const
+{
+    assert(i <= mBucketCount);
+    if (i == mBucketCount) {
+        return mPending;
+    }
+    auto size = (uint32_t) mBuckets.size();
+    return mBuckets[(mBucketHead + size - mBucketCount + i) % size];
+}
 
-MetricsGuiMetric::MetricsGuiMetric()
+void MetricsGuiHistogram::Initialize(
+    uint32_t binCount,
+    float minValue,
+    float maxValue,
+    Scale scale)
 {
-    auto c = ImColor::HSV(0.2f * gConstructedMetricIndex++, 0.8f, 0.8f);
-    mColor[0] = c.Value.x;
-    mColor[1] = c.Value.y;
-    mColor[2] = c.Value.z;
-    mColor[3] = c.Value.w;
+    assert(minValue < maxValue);
+    assert(scale == LINEAR || minValue > 0.f);
+
+    mScale = scale;
+    mEdges.clear();
+    switch (scale) {
+    case LINEAR:
+        for (uint32_t i = 0; i <= binCount; ++i) {
+            mEdges.emplace_back(minValue + (maxValue - minValue) * i / binCount);
+        }
+        break;
 
-    Initialize("", "", NONE);
+    case LOGARITHMIC:
+        for (uint32_t i = 0; i <= binCount; ++i) {
+            mEdges.emplace_back(minValue * powf(maxValue / minValue, (float) i / binCount));
+        }
+        break;
+
+    case SI_DECADES: {
+        // Start at the largest step <= minValue and end at the smallest step
+        // >= maxValue
+        static float const steps[] = { 1.f, 2.f, 5.f };
+        auto decade = powf(10.f, floorf(log10f(minValue)));
+        for (uint32_t i = 0; ; ) {
+            auto edge = decade * steps[i];
+            if (edge <= minValue * 1.0001f) {
+                mEdges.assign(1, edge);
+            } else {
+                mEdges.emplace_back(edge);
+                if (edge >= maxValue * 0.9999f) {
+                    break;
+                }
+            }
+            if (++i == 3) {
+                i = 0;
+                decade *= 10.f;
+            }
+        }
+        break;
+    }
+    }
+
+    mCounts.assign(mEdges.size() - 1, 0);
 }
 
-MetricsGuiMetric::MetricsGuiMetric(
-    char const* description,
-    char const* units,
-    uint32_t flags)
+uint32_t MetricsGuiHistogram::GetBin(
+    float value) const
 {
-    auto c = ImColor::HSV(0.2f * gConstructedMetricIndex++, 0.8f, 0.8f);
-    mColor[0] = c.Value.x;
-    mColor[1] = c.Value.y;
-    mColor[2] = c.Value.z;
-    mColor[3] = c.Value.w;
+    auto binCount = (uint32_t) mCounts.size();
+    auto minValue = mEdges.front();
+    auto maxValue = mEdges.back();
+    if (!(value > minValue)) {
+        return 0;
+    }
+    if (value >= maxValue) {
+        return binCount - 1;
+    }
 
-    Initialize(description, units, flags);
+    float t;
+    switch (mScale) {
+    case LINEAR:      t = (value - minValue) / (maxValue - minValue); break;
+    case LOGARITHMIC: t = logf(value / minValue) / logf(maxValue / minValue); break;
+    default:
+        return (uint32_t) (std::upper_bound(mEdges.begin(), mEdges.end(), value) - mEdges.begin()) - 1;
+    }
+    return std::min((uint32_t) (t * binCount), binCount - 1);
 }
 
-void MetricsGuiMetric::Initialize(
-    char const* description,
-    char const* units,
-    uint32_t flags)
+float MetricsGuiMetric::GetAverageValue() const
 {
-    mDescription = description == nullptr ? "" : description;
-    mUnits = units == nullptr ? "" : units;
-    mTotalInHistory = 0.;
-    mHistoryCount = 0;
-    memset(mHistory, 0, NUM_HISTORY_SAMPLES * sizeof(float));
-    mKnownMinValue = 0.f;
-    mKnownMaxValue = 0.f;
-    mFlags = flags;
-    mSelected = false;
+    return mHistoryCount == 0 ? 0.f : ((float) mTotalInHistory / mHistoryCount);
 }
 
-void MetricsGuiMetric::SetLastValue(
-    float value,
-    uint32_t prevIndex)
+MetricsGuiCounter::MetricsGuiCounter(
+    char const* description,
+    char const* units,
+    uint32_t flags,
+    uint32_t historySize,
+    uint32_t shardCount)
+    : MetricsGuiMetric(description, units, flags, historySize)
 {
-    assert(prevIndex < NUM_HISTORY_SAMPLES);
-    auto p = &mHistory[NUM_HISTORY_SAMPLES - 1 - prevIndex];
-    mTotalInHistory -= *p;
-    *p = value;
-    mTotalInHistory += value;
+    assert(shardCount > 0);
+
+    // Align the shards to a cache line so that each shard is in its own line
+    mShardCount = shardCount;
+    mShardMemory = malloc(shardCount * sizeof(Shard) + 63);
+    mShards = (Shard*) (((uintptr_t) mShardMemory + 63) & ~(uintptr_t) 63);
+    for (uint32_t i = 0; i < shardCount; ++i) {
+        new (&mShards[i]) Shard;
+        mShards[i].mCount.store(0, std::memory_order_relaxed);
+    }
 }
 
-void MetricsGuiMetric::AddNewValue(
-    float value)
+MetricsGuiCounter::~MetricsGuiCounter()
 {
-    mTotalInHistory -= mHistory[0];
-    memmove(
-        mHistory,
-        mHistory + 1,
-        (NUM_HISTORY_SAMPLES - 1) * sizeof(mHistory[0]));
-    mHistory[NUM_HISTORY_SAMPLES - 1] = value;
-    mTotalInHistory += value;
-    mHistoryCount = std::min((uint32_t) NUM_HISTORY_SAMPLES, mHistoryCount + 1);
+    for (uint32_t i = 0; i < mShardCount; ++i) {
+        mShards[i].~Shard();
+    }
+    free(mShardMemory);
 }
 
-float MetricsGuiMetric::GetLastValue(
-    uint32_t prevIndex) const
+uint64_t MetricsGuiCounter::Collect()
 {
-    assert(prevIndex < NUM_HISTORY_SAMPLES);
-    return mHistory[NUM_HISTORY_SAMPLES - 1 - prevIndex];
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < mShardCount; ++i) {
+        total += mShards[i].mCount.exchange(0, std::memory_order_relaxed);
+    }
+    AddNewValue((float) total);
+    return total;
 }
 
-float MetricsGuiMetric::GetAverageValue() const
+uint32_t MetricsGuiCounter::GetThreadShardIndex()
 {
-    return mHistoryCount == 0 ? 0.f : ((float) mTotalInHistory / mHistoryCount);
+    static std::atomic<uint32_t> nextIndex(0);
+    static thread_local uint32_t index = nextIndex.fetch_add(1, std::memory_order_relaxed);
+    return index;
 }
 
 // Note: we defer computing the sizes because ImGui doesn't load the font until
@@ -244,8 +1764,8 @@ void MetricsGuiPlot::WidthInfo::Initialize()
     auto valueWidth  = ImGui::CalcTextSize("888. X").x;
     for (auto linkedPlot : mLinkedPlots) {
         for (auto metric : linkedPlot->mMetrics) {
-            auto descWidth  = ImGui::CalcTextSize(metric->mDescription.c_str()).x;
-            auto unitsWidth = ImGui::CalcTextSize(metric->mUnits.c_str()).x;
+            auto descWidth  = ImGui::CalcTextSize(metric->mDescription).x;
+            auto unitsWidth = ImGui::CalcTextSize(metric->mUnits).x;
             auto quantWidth = valueWidth + unitsWidth;
 
             mDescWidth   = std::max(mDescWidth,   descWidth);
@@ -261,29 +1781,46 @@ MetricsGuiPlot::MetricsGuiPlot()
     : mMetrics()
     , mMetricRange()
     , mWidthInfo(new MetricsGuiPlot::WidthInfo(this))
+    , mGeometry(new MetricsGuiPlotGeometry())
+    , mFrameArena(new MetricsGuiFrameArena())
     , mMinValue(0.f)
     , mMaxValue(0.f)
     , mRangeInitialized(false)
+    , mAxesKey()
+    , mMetricTargetRange()
+    , mTargetMinValue(0.f)
+    , mTargetMaxValue(0.f)
+    , mPlotWidth(0)
+    , mPlotHeight(0.f)
     , mBarRounding(0.f)
     , mRangeDampening(0.95f)
     , mInlinePlotRowCount(2)
     , mPlotRowCount(5)
     , mVBarMinWidth(6)
     , mVBarGapWidth(1)
+    , mHistoryLength(0)
+    , mTimeWindow(0.f)
+    , mPercentiles()
     , mShowAverage(false)
+    , mShowPercentiles(false)
     , mShowInlineGraphs(false)
     , mShowOnlyIfSelected(false)
     , mShowLegendDesc(true)
     , mShowLegendColor(true)
     , mShowLegendUnits(true)
     , mShowLegendAverage(false)
+    , mShowLegendPercentiles(false)
     , mShowLegendMin(true)
     , mShowLegendMax(true)
     , mBarGraph(false)
     , mStacked(false)
     , mSharedAxis(false)
     , mFilterHistory(true)
+    , mThinLines(false)
+    , mFilterMinMax(false)
 {
+    mPercentiles.emplace_back(95.f);
+    mPercentiles.emplace_back(99.f);
 }
 
 MetricsGuiPlot::MetricsGuiPlot(
@@ -291,28 +1828,43 @@ MetricsGuiPlot::MetricsGuiPlot(
     : mMetrics(copy.mMetrics)
     , mMetricRange(copy.mMetricRange)
     , mWidthInfo(copy.mWidthInfo)
+    , mGeometry(new MetricsGuiPlotGeometry())
+    , mFrameArena(new MetricsGuiFrameArena())
     , mMinValue(copy.mMinValue)
     , mMaxValue(copy.mMaxValue)
     , mRangeInitialized(copy.mRangeInitialized)
+    , mAxesKey(copy.mAxesKey)
+    , mMetricTargetRange(copy.mMetricTargetRange)
+    , mTargetMinValue(copy.mTargetMinValue)
+    , mTargetMaxValue(copy.mTargetMaxValue)
+    , mPlotWidth(copy.mPlotWidth)
+    , mPlotHeight(copy.mPlotHeight)
     , mBarRounding(copy.mBarRounding)
     , mRangeDampening(copy.mRangeDampening)
     , mInlinePlotRowCount(copy.mInlinePlotRowCount)
     , mPlotRowCount(copy.mPlotRowCount)
     , mVBarMinWidth(copy.mVBarMinWidth)
     , mVBarGapWidth(copy.mVBarGapWidth)
+    , mHistoryLength(copy.mHistoryLength)
+    , mTimeWindow(copy.mTimeWindow)
+    , mPercentiles(copy.mPercentiles)
     , mShowAverage(copy.mShowAverage)
+    , mShowPercentiles(copy.mShowPercentiles)
     , mShowInlineGraphs(copy.mShowInlineGraphs)
     , mShowOnlyIfSelected(copy.mShowOnlyIfSelected)
     , mShowLegendDesc(copy.mShowLegendDesc)
     , mShowLegendColor(copy.mShowLegendColor)
     , mShowLegendUnits(copy.mShowLegendUnits)
     , mShowLegendAverage(copy.mShowLegendAverage)
+    , mShowLegendPercentiles(copy.mShowLegendPercentiles)
     , mShowLegendMin(copy.mShowLegendMin)
     , mShowLegendMax(copy.mShowLegendMax)
     , mBarGraph(copy.mBarGraph)
     , mStacked(copy.mStacked)
     , mSharedAxis(copy.mSharedAxis)
     , mFilterHistory(copy.mFilterHistory)
+    , mThinLines(copy.mThinLines)
+    , mFilterMinMax(copy.mFilterMinMax)
 {
     mWidthInfo->mLinkedPlots.emplace_back(this);
 }
@@ -325,6 +1877,8 @@ MetricsGuiPlot::~MetricsGuiPlot()
     if (mWidthInfo->mLinkedPlots.empty()) {
         delete mWidthInfo;
     }
+    delete mGeometry;
+    delete mFrameArena;
 }
 
 void MetricsGuiPlot::LinkLegends(
@@ -359,6 +1913,31 @@ void MetricsGuiPlot::LinkLegends(
 
 void MetricsGuiPlot::UpdateAxes()
 {
+    for (auto metric : mMetrics) {
+        metric->DrainStagedValues();
+    }
+
+    // The ranges the axes move towards only need recomputing when a metric's
+    // history or the options they depend on have changed.
+    static std::vector<uint32_t> key;
+    key.clear();
+    key.emplace_back(mHistoryLength);
+    key.emplace_back(mPlotWidth);
+    key.emplace_back((mSharedAxis ? 2u : 0u) | (mStacked ? 1u : 0u));
+    for (auto metric : mMetrics) {
+        auto address = (uint64_t) (uintptr_t) metric;
+        key.emplace_back((uint32_t) address);
+        key.emplace_back((uint32_t) (address >> 32));
+        key.emplace_back(metric->mGeneration);
+        key.emplace_back(metric->mFlags);
+        AddKey(&key, metric->mKnownMinValue);
+        AddKey(&key, metric->mKnownMaxValue);
+    }
+    if (!mRangeInitialized || key != mAxesKey) {
+        mAxesKey = key;
+        UpdateTargetRanges();
+    }
+
     float oldWeight;
     if (mRangeInitialized) {
         oldWeight = std::min(1.f, std::max(0.f, mRangeDampening));
@@ -366,42 +1945,97 @@ void MetricsGuiPlot::UpdateAxes()
         oldWeight = 0.f;
         mRangeInitialized = true;
     }
-    auto newWeight = 1.f - oldWeight;
 
+    // Ranges within a pixel of the history plot of their target snap to
+    // it, which lets DrawHistory() replay its geometry once the axes settle.
+    auto pixelFraction = mPlotHeight > 0.f ? 1.f / mPlotHeight : 0.f;
+    for (size_t i = 0, N = mMetrics.size(); i < N; ++i) {
+        auto metricRange = &mMetricRange[i];
+        auto const& targetRange = mMetricTargetRange[i];
+        auto tolerance = (targetRange.second - targetRange.first) * pixelFraction;
+        metricRange->first  = DampenTowards(metricRange->first,  targetRange.first,  oldWeight, tolerance);
+        metricRange->second = DampenTowards(metricRange->second, targetRange.second, oldWeight, tolerance);
+    }
+
+    auto minPlotValue = mTargetMinValue;
+    auto maxPlotValue = mTargetMaxValue;
+    if (mSharedAxis) {
+        minPlotValue = mMetricRange[0].first;
+        maxPlotValue = mMetricRange[0].second;
+    }
+
+    auto tolerance = (maxPlotValue - minPlotValue) * pixelFraction;
+    mMinValue = DampenTowards(mMinValue, minPlotValue, oldWeight, tolerance);
+    mMaxValue = DampenTowards(mMaxValue, maxPlotValue, oldWeight, tolerance);
+}
+
+void MetricsGuiPlot::UpdateTargetRanges()
+{
+    // Select the same tiers and archive values DrawMetrics() will, which
+    // draws at most a value per pixel
+    auto historyLength = GetPlotHistoryLength(this, mMetrics);
+    auto maxValueCount = mPlotWidth > 0 ? mPlotWidth : (uint32_t) MetricsGuiMetric::NUM_HISTORY_SAMPLES;
     float minPlotValue = FLT_MAX;
     float maxPlotValue = FLT_MIN;
+    mMetricTargetRange.resize(mMetrics.size());
     for (size_t i = 0, N = mMetrics.size(); i < N; ++i) {
         auto metric = mMetrics[i];
-        auto metricRange = &mMetricRange[i];
+
+        // Plots reaching back further than the history also include the
+        // range of the tier buckets or archive blocks they span
+        auto historyMinValue = metric->GetHistoryMinValue();
+        auto historyMaxValue = metric->GetHistoryMaxValue();
+        auto tier = SelectHistoryTier(metric, historyLength, maxValueCount);
+        if (tier != nullptr) {
+            auto bucketCount = GetTierBucketCount(tier, historyLength);
+            auto firstBucket = tier->mBucketCount + (tier->mPending.mCount > 0 ? 1 : 0) - bucketCount;
+            for (uint32_t j = 0; j < bucketCount; ++j) {
+                auto const& bucket = tier->GetBucket(firstBucket + j);
+                historyMinValue = std::min(historyMinValue, bucket.mMin);
+                historyMaxValue = std::max(historyMaxValue, bucket.mMax);
+            }
+        }
+        auto archiveCount = GetPlotArchiveCount(metric, historyLength, maxValueCount);
+        if (archiveCount > 0) {
+            auto archiveEnd = metric->mArchive->GetValueCount();
+            auto aggregate = metric->mArchive->GetBlockAggregate(archiveEnd - archiveCount, archiveEnd);
+            historyMinValue = std::min(historyMinValue, aggregate.mMin);
+            historyMaxValue = std::max(historyMaxValue, aggregate.mMax);
+        }
 
         auto knownMinValue = 0 != (metric->mFlags & MetricsGuiMetric::KNOWN_MIN_VALUE);
         auto knownMaxValue = 0 != (metric->mFlags & MetricsGuiMetric::KNOWN_MAX_VALUE);
         auto historyRange = std::make_pair(
-            knownMinValue ? &metric->mKnownMinValue : std::min_element(metric->mHistory, metric->mHistory + MetricsGuiMetric::NUM_HISTORY_SAMPLES),
-            knownMaxValue ? &metric->mKnownMaxValue : std::max_element(metric->mHistory, metric->mHistory + MetricsGuiMetric::NUM_HISTORY_SAMPLES));
-        metricRange->first  = metricRange->first  * oldWeight + *historyRange.first  * newWeight;
-        metricRange->second = metricRange->second * oldWeight + *historyRange.second * newWeight;
+            knownMinValue ? metric->mKnownMinValue : historyMinValue,
+            knownMaxValue ? metric->mKnownMaxValue : historyMaxValue);
+        mMetricTargetRange[i] = historyRange;
 
-        minPlotValue = std::min(minPlotValue, *historyRange.first);
-        maxPlotValue = std::max(maxPlotValue, *historyRange.second);
+        minPlotValue = std::min(minPlotValue, historyRange.first);
+        maxPlotValue = std::max(maxPlotValue, historyRange.second);
     }
 
-    if (mSharedAxis) {
-        minPlotValue = mMetricRange[0].first;
-        maxPlotValue = mMetricRange[0].second;
-    } else if (mStacked) {
-        maxPlotValue = FLT_MIN;
-        for (size_t i = 0; i < MetricsGuiMetric::NUM_HISTORY_SAMPLES; ++i) {
-            float stackedValue = 0.f;
-            for (auto metric : mMetrics) {
-                stackedValue += metric->mHistory[i];
-            }
-            maxPlotValue = std::max(maxPlotValue, stackedValue);
+    // Shared axes use the first metric's range, see UpdateAxes()
+    if (mStacked && !mSharedAxis) {
+        // Histories of different sizes are aligned at their newest value.
+        uint32_t historySize = 0;
+        for (auto metric : mMetrics) {
+            historySize = std::max(historySize, metric->mHistorySize);
         }
+
+        // Sum the histories column-wise, a span at a time
+        auto stackedValues = GetScratchBuffer(historySize);
+        memset(stackedValues, 0, historySize * sizeof(float));
+        for (auto metric : mMetrics) {
+            auto history = metric->GetHistory();
+            auto dst = stackedValues + historySize - metric->mHistorySize;
+            MetricsGuiKernels::Accumulate(dst, history.mSpan[0], history.mSpanCount[0]);
+            MetricsGuiKernels::Accumulate(dst + history.mSpanCount[0], history.mSpan[1], history.mSpanCount[1]);
+        }
+        maxPlotValue = std::max(FLT_MIN, MetricsGuiKernels::ReduceMax(stackedValues, historySize));
     }
 
-    mMinValue = mMinValue * oldWeight + minPlotValue * newWeight;
-    mMaxValue = mMaxValue * oldWeight + maxPlotValue * newWeight;
+    mTargetMinValue = minPlotValue;
+    mTargetMaxValue = maxPlotValue;
 }
 
 void MetricsGuiPlot::AddMetric(
@@ -425,7 +2059,7 @@ void MetricsGuiPlot::AddMetrics(
 void MetricsGuiPlot::SortMetricsByName()
 {
     std::sort(mMetrics.begin(), mMetrics.end(), [](MetricsGuiMetric* a, MetricsGuiMetric* b) {
-        return a->mDescription.compare(b->mDescription) < 0;
+        return strcmp(a->mDescription, b->mDescription) < 0;
     });
 }
 
@@ -444,12 +2078,264 @@ bool DrawPrefix(
     return true;
 }
 
-void DrawMetrics(
+void DrawLegendPercentiles(
+    MetricsGuiPlot const* plot,
+    MetricsGuiMetric const* metric,
+    char const* units,
+    bool useSiUnitPrefix)
+{
+    if (metric->mSortedHistory == nullptr) {
+        return;
+    }
+
+    for (auto percentile : plot->mPercentiles) {
+        char prefix[32];
+        snprintf(prefix, _countof(prefix), "P%g: ", percentile);
+        DrawQuantityLabel(metric->GetPercentileValue(percentile), units, prefix, useSiUnitPrefix);
+    }
+}
+
+// Builds the points of a line series so it can be drawn as one polyline.
+// Points in the same pixel column are collapsed into a vertical span through
+// their extremes, and runs of points at the same height into one segment.
+struct PolylineBuilder {
+    std::vector<ImVec2>* mPoints;
+    float mX;
+    float mEntryY;
+    float mMinY;
+    float mMaxY;
+    float mExitY;
+    bool mHasColumn;
+
+    explicit PolylineBuilder(std::vector<ImVec2>* points)
+        : mPoints(points)
+        , mHasColumn(false)
+    {
+        points->clear();
+    }
+
+    void AddPoint(ImVec2 p)
+    {
+        if (mHasColumn && (int) p.x == (int) mX) {
+            mMinY = std::min(mMinY, p.y);
+            mMaxY = std::max(mMaxY, p.y);
+            mExitY = p.y;
+            return;
+        }
+
+        FlushColumn();
+        mX = p.x;
+        mEntryY = p.y;
+        mMinY = p.y;
+        mMaxY = p.y;
+        mExitY = p.y;
+        mHasColumn = true;
+    }
+
+    // Visit the extreme furthest from the exit first, so the span ends
+    // near the next column.
+    void FlushColumn()
+    {
+        if (!mHasColumn) {
+            return;
+        }
+        auto maxFirst = mMaxY - mExitY > mExitY - mMinY;
+        AddVertex(mEntryY);
+        AddVertex(maxFirst ? mMaxY : mMinY);
+        AddVertex(maxFirst ? mMinY : mMaxY);
+        AddVertex(mExitY);
+        mHasColumn = false;
+    }
+
+    void AddVertex(float y)
+    {
+        auto& points = *mPoints;
+        auto n = points.size();
+        if (n > 0 && points[n - 1].x == mX && points[n - 1].y == y) {
+            return;
+        }
+        if (n > 1 && points[n - 1].y == y && points[n - 2].y == y) {
+            points[n - 1].x = mX;
+            return;
+        }
+        points.emplace_back(mX, y);
+    }
+};
+
+// Points of the series being drawn: polyline points, or pairs of bar
+// corners.
+std::vector<ImVec2>* GetPointBuffer()
+{
+    static std::vector<ImVec2> points;
+    return &points;
+}
+
+// Draw the series built by builder, and start a new one.
+void DrawPolyline(
+    ImDrawList* drawList,
+    PolylineBuilder* builder,
+    ImU32 color,
+    bool thinLines)
+{
+    builder->FlushColumn();
+    auto const& points = *builder->mPoints;
+    if (points.size() > 1) {
+        auto flags = drawList->Flags;
+        if (thinLines) {
+            drawList->Flags &= ~ImDrawListFlags_AntiAliasedLines;
+        }
+        drawList->AddPolyline(points.data(), (int) points.size(), color, false, 1.f);
+        drawList->Flags = flags;
+    }
+    builder->mPoints->clear();
+}
+
+// Draw the bars given by pairs of opposite corners in points, and clear
+// points.  Unrounded bars are written as one batch of quads.
+void DrawBars(
+    ImDrawList* drawList,
+    std::vector<ImVec2>* points,
+    ImU32 color,
+    float rounding)
+{
+    auto const& corners = *points;
+    auto barCount = corners.size() / 2;
+    if (rounding > 0.f) {
+        for (size_t i = 0; i < barCount; ++i) {
+            drawList->AddRectFilled(corners[2 * i], corners[2 * i + 1], color, rounding);
+        }
+    } else if (barCount > 0 && (color & IM_COL32_A_MASK) != 0) {
+        drawList->PrimReserve((int) barCount * 6, (int) barCount * 4);
+        for (size_t i = 0; i < barCount; ++i) {
+            drawList->PrimRect(corners[2 * i], corners[2 * i + 1], color);
+        }
+    }
+    points->clear();
+}
+
+// Returns true if geometry holds the series a DrawMetrics() call would draw
+// into inner_bb, which is the case if none of their metrics' histories, the
+// axis range, the options they are drawn with and the plot's size have
+// changed.  Moving the plot by whole pixels keeps the geometry.
+bool UpdateGeometryKey(
+    MetricsGuiPlotGeometry* geometry,
+    MetricsGuiPlot const* plot,
+    MetricRange metrics,
+    ImRect const& inner_bb,
+    uint32_t historySize,
+    float plotMinValue,
+    float plotMaxValue,
+    ImDrawList const* drawList)
+{
+    static std::vector<uint32_t> key;
+    key.clear();
+    AddKey(&key, inner_bb.GetWidth());
+    AddKey(&key, inner_bb.GetHeight());
+    AddKey(&key, inner_bb.Min.x - floorf(inner_bb.Min.x));
+    AddKey(&key, inner_bb.Min.y - floorf(inner_bb.Min.y));
+    AddKey(&key, plotMinValue);
+    AddKey(&key, plotMaxValue);
+    AddKey(&key, plot->mBarRounding);
+    AddKey(&key, drawList->_Data->TexUvWhitePixel.x);
+    AddKey(&key, drawList->_Data->TexUvWhitePixel.y);
+    key.emplace_back(historySize);
+    key.emplace_back(plot->mVBarMinWidth);
+    key.emplace_back(plot->mVBarGapWidth);
+    key.emplace_back((uint32_t) drawList->Flags);
+    key.emplace_back(
+        (plot->mShowAverage ? 1u : 0u) |
+        (plot->mShowPercentiles ? 2u : 0u) |
+        (plot->mShowOnlyIfSelected ? 4u : 0u) |
+        (plot->mBarGraph ? 8u : 0u) |
+        (plot->mStacked ? 16u : 0u) |
+        (plot->mFilterHistory ? 32u : 0u) |
+        (plot->mThinLines ? 64u : 0u) |
+        (plot->mFilterMinMax ? 128u : 0u));
+    if (plot->mShowPercentiles) {
+        for (auto percentile : plot->mPercentiles) {
+            AddKey(&key, percentile);
+        }
+    }
+    for (auto metric : metrics) {
+        auto address = (uint64_t) (uintptr_t) metric;
+        key.emplace_back((uint32_t) address);
+        key.emplace_back((uint32_t) (address >> 32));
+        key.emplace_back(metric->mGeneration);
+        key.emplace_back(metric->mSelected ? 1u : 0u);
+        key.emplace_back(ImGui::ColorConvertFloat4ToU32(*(ImVec4*) &metric->mColor));
+    }
+
+    if (key == geometry->mKey) {
+        return true;
+    }
+    geometry->mKey = key;
+    return false;
+}
+
+// Copy the vertices and indices added to drawList since vtxBegin and
+// idxBegin into geometry.
+void RecordGeometry(
+    MetricsGuiPlotGeometry* geometry,
+    ImDrawList const* drawList,
+    int vtxBegin,
+    int idxBegin,
+    unsigned int idxBase,
+    ImVec2 origin)
+{
+    auto vtxCount = drawList->VtxBuffer.Size - vtxBegin;
+    auto idxCount = drawList->IdxBuffer.Size - idxBegin;
+
+    // Leave room for the series to grow, so that a plot whose histories are
+    // still filling doesn't reallocate its geometry every few frames.
+    if (vtxCount > geometry->mVertices.Capacity) {
+        geometry->mVertices.reserve(vtxCount * 2);
+    }
+    if (idxCount > geometry->mIndices.Capacity) {
+        geometry->mIndices.reserve(idxCount * 2);
+    }
+    geometry->mVertices.resize(vtxCount);
+    geometry->mIndices.resize(idxCount);
+    for (int i = 0; i < vtxCount; ++i) {
+        geometry->mVertices[i] = drawList->VtxBuffer[vtxBegin + i];
+        geometry->mVertices[i].pos -= origin;
+    }
+    for (int i = 0; i < idxCount; ++i) {
+        geometry->mIndices[i] = (ImDrawIdx) (drawList->IdxBuffer[idxBegin + i] - idxBase);
+    }
+}
+
+void ReplayGeometry(
+    MetricsGuiPlotGeometry const& geometry,
+    ImDrawList* drawList,
+    ImVec2 origin)
+{
+    auto vtxCount = geometry.mVertices.Size;
+    auto idxCount = geometry.mIndices.Size;
+    if (idxCount == 0) {
+        return;
+    }
+
+    drawList->PrimReserve(idxCount, vtxCount);
+    auto idxBase = drawList->_VtxCurrentIdx;
+    for (int i = 0; i < vtxCount; ++i) {
+        drawList->_VtxWritePtr[i] = geometry.mVertices[i];
+        drawList->_VtxWritePtr[i].pos += origin;
+    }
+    for (int i = 0; i < idxCount; ++i) {
+        drawList->_IdxWritePtr[i] = (ImDrawIdx) (geometry.mIndices[i] + idxBase);
+    }
+    drawList->_VtxWritePtr += vtxCount;
+    drawList->_IdxWritePtr += idxCount;
+    drawList->_VtxCurrentIdx += vtxCount;
+}
+
+// Lay out and draw the frame of a plot that is plotRowCount text rows high
+// and leaves room for the legend.  Returns false if the plot is clipped.
+bool AddPlotFrame(
     MetricsGuiPlot* plot,
-    std::vector<MetricsGuiMetric*> const& metrics,
     uint32_t plotRowCount,
-    float plotMinValue,
-    float plotMaxValue)
+    ImRect* frame_bb,
+    ImRect* inner_bb)
 {
     auto window = ImGui::GetCurrentWindow();
     auto const& style = GImGui->Style;
@@ -463,31 +2349,72 @@ void DrawMetrics(
         PLOT_LEGEND_PADDING);
     auto plotHeight = std::max(0.f, (textHeight + LEGEND_TEXT_VERTICAL_SPACING) * plotRowCount);
 
-    ImRect frame_bb(
+    *frame_bb = ImRect(
         window->DC.CursorPos,
         window->DC.CursorPos + ImVec2(plotWidth, plotHeight));
-    ImRect inner_bb(
-        frame_bb.Min + style.FramePadding,
-        frame_bb.Max - style.FramePadding);
+    *inner_bb = ImRect(
+        frame_bb->Min + style.FramePadding,
+        frame_bb->Max - style.FramePadding);
+
+    ImGui::ItemSize(*frame_bb, style.FramePadding.y);
+    if (!ImGui::ItemAdd(*frame_bb, 0)) {
+        return false;
+    }
 
-    ImGui::ItemSize(frame_bb, style.FramePadding.y);
-    if (!ImGui::ItemAdd(frame_bb, NULL)) {
+    ImGui::RenderFrame(frame_bb->Min, frame_bb->Max, ImGui::GetColorU32(ImGuiCol_FrameBg), true, style.FrameRounding);
+    return true;
+}
+
+// If geometry is not null, the series are drawn from it when nothing they
+// depend on has changed, and recorded into it otherwise.  Plots with
+// mTimeWindow are always tessellated, since their series move with time.
+void DrawMetrics(
+    MetricsGuiPlot* plot,
+    MetricRange metrics,
+    uint32_t plotRowCount,
+    float plotMinValue,
+    float plotMaxValue,
+    MetricsGuiPlotGeometry* geometry)
+{
+    auto window = ImGui::GetCurrentWindow();
+    auto textHeight = ImGui::GetTextLineHeight();
+    FrameArenaScope arenaScope(plot->mFrameArena);
+
+    ImRect frame_bb;
+    ImRect inner_bb;
+    if (!AddPlotFrame(plot, plotRowCount, &frame_bb, &inner_bb)) {
         return;
     }
 
-    ImGui::RenderFrame(frame_bb.Min, frame_bb.Max, ImGui::GetColorU32(ImGuiCol_FrameBg), true, style.FrameRounding);
+    auto plotWidth = inner_bb.GetWidth();
+    auto plotHeight = inner_bb.GetHeight();
+    plot->mPlotWidth = (uint32_t) plotWidth;
+    if (geometry != nullptr) {
+        plot->mPlotHeight = plotHeight;
+    }
+
+    // The plot spans mHistoryLength values, or the largest history.  Each
+    // metric's series is aligned so that its newest value is at the right
+    // edge of the plot.
+    auto historySize = GetPlotHistoryLength(plot, metrics);
 
-    plotWidth = inner_bb.GetWidth();
-    plotHeight = inner_bb.GetHeight();
+    // With mTimeWindow, points are spaced evenly in time instead, and
+    // represent the values added during their time span.
+    bool useTimeWindow = plot->mTimeWindow > 0.f;
 
-    size_t pointCount = MetricsGuiMetric::NUM_HISTORY_SAMPLES;
+    size_t pointCount = useTimeWindow ? (size_t) plotWidth : historySize;
     size_t maxBarCount = (size_t) (plotWidth / (plot->mVBarMinWidth + plot->mVBarGapWidth));
 
     if (plotMaxValue == plotMinValue) {
         pointCount = 0;
     }
 
-    bool useFilterPath = plot->mFilterHistory || (maxBarCount > pointCount);
+    bool useFilterPath = useTimeWindow || plot->mFilterHistory || (maxBarCount > pointCount);
+
+    // With mFilterMinMax, lines span the extremes of the values each point
+    // represents, and bars reach their maximum, so single-value spikes stay
+    // visible however many values a point represents.
+    bool useMinMax = plot->mFilterMinMax && useFilterPath && !useTimeWindow && !plot->mStacked;
     if (!useFilterPath) {
         pointCount = maxBarCount;
     } else if (plot->mBarGraph) {
@@ -495,34 +2422,116 @@ void DrawMetrics(
     } else {
         pointCount = std::min(pointCount, (size_t) (plotWidth));
     }
-    if (pointCount > 0) {
-        std::vector<float> baseValue(pointCount, 0.f);
+
+    auto drawList = window->DrawList;
+    auto vtxBegin = drawList->VtxBuffer.Size;
+    auto idxBegin = drawList->IdxBuffer.Size;
+    auto idxBase = drawList->_VtxCurrentIdx;
+    if (useTimeWindow) {
+        geometry = nullptr;
+    }
+    auto cached = geometry != nullptr && UpdateGeometryKey(geometry, plot, metrics, inner_bb, historySize, plotMinValue, plotMaxValue, drawList);
+    if (cached) {
+        ReplayGeometry(*geometry, drawList, inner_bb.Min);
+    } else if (pointCount > 0) {
+        auto baseValue = AllocateFrameArray<float>(plot->mFrameArena, pointCount);
+        std::fill(baseValue, baseValue + pointCount, 0.f);
         auto hScale = plotWidth / (float) (plot->mBarGraph ? pointCount : (pointCount - 1));
         auto vScale = plotHeight / (plotMaxValue - plotMinValue);
+
+        uint64_t windowTicks = 0;
+        uint64_t windowBegin = 0;
+        if (useTimeWindow) {
+            auto frequency = GetPerfTimerFrequency();
+            windowTicks = (uint64_t) ((double) plot->mTimeWindow * frequency.Numerator / frequency.Denominator);
+            windowBegin = GetPerfTimerCount() - windowTicks;
+        }
+
         for (auto metric : metrics) {
             if (plot->mShowOnlyIfSelected && !metric->mSelected) {
                 continue;
             }
+            if (useTimeWindow && metric->mTimestamps == nullptr) {
+                continue;
+            }
 
             auto color = ImGui::ColorConvertFloat4ToU32(*(ImVec4*) &metric->mColor);
-
-            size_t historyBeginIdx = useFilterPath
-                ? 0
-                : (MetricsGuiMetric::NUM_HISTORY_SAMPLES - pointCount);
+            auto series = useTimeWindow
+                ? PlotSeries { metric->GetHistory(), 1, 0, 0, nullptr, nullptr }
+                : GetPlotSeries(metric, historySize, (uint32_t) plotWidth);
+            auto samplesPerValue = (size_t) series.mSamplesPerValue;
+            auto seriesSpan = series.mValues.Size() * samplesPerValue;
+
+            size_t historyBeginIdx = useTimeWindow
+                ? metric->FindHistoryIndex(windowBegin)
+                : useFilterPath ? 0 : (historySize - pointCount);
             ImVec2 p;
             float prevB = 0.f;
+            bool hasPrev = false;
+            auto points = GetPointBuffer();
+            PolylineBuilder line(points);
             for (size_t i = 0; i < pointCount; ++i) {
-                size_t historyEndIdx = useFilterPath
-                    ? ((i + 1) * MetricsGuiMetric::NUM_HISTORY_SAMPLES / pointCount)
-                    : (historyBeginIdx + 1);
-                size_t N = historyEndIdx - historyBeginIdx;
-                float v = 0.f;
-                if (N > 0) {
-                    do {
-                        v += metric->mHistory[historyBeginIdx];
-                        ++historyBeginIdx;
-                    } while (historyBeginIdx < historyEndIdx);
-                    v = v / (float) N;
+                float v;
+                float minV = 0.f;
+                if (useTimeWindow) {
+                    // Average the values added during the point's time span.
+                    // If there are none, the span lies within the time taken
+                    // by the next value, unless that is the oldest value or
+                    // there is no next value yet.
+                    auto endTime = windowBegin + (uint64_t) ((i + 1) * windowTicks / pointCount);
+                    auto historyEndIdx = historyBeginIdx;
+                    while (historyEndIdx < metric->mHistorySize && metric->GetTimestamp((uint32_t) historyEndIdx) < endTime) {
+                        ++historyEndIdx;
+                    }
+
+                    if (historyEndIdx > historyBeginIdx) {
+                        v = SumHistoryRange(
+                            series.mValues,
+                            (uint32_t) historyBeginIdx,
+                            (uint32_t) historyEndIdx) / (float) (historyEndIdx - historyBeginIdx);
+                    } else if (historyEndIdx < metric->mHistorySize && historyEndIdx > metric->mHistorySize - metric->mHistoryCount) {
+                        v = series.mValues[(uint32_t) historyEndIdx];
+                    } else {
+                        if (hasPrev && !plot->mBarGraph) {
+                            DrawPolyline(window->DrawList, &line, color, plot->mThinLines);
+                        }
+                        hasPrev = false;
+                        continue;
+                    }
+                    historyBeginIdx = historyEndIdx;
+                } else {
+                    size_t historyEndIdx = useFilterPath
+                        ? ((i + 1) * historySize / pointCount)
+                        : (historyBeginIdx + 1);
+
+                    // Skip points before the start of this metric's series
+                    if (historyEndIdx + seriesSpan <= historySize) {
+                        historyBeginIdx = historyEndIdx;
+                        hasPrev = false;
+                        continue;
+                    }
+
+                    // Average the series values overlapping the point
+                    auto seriesBeginIdx = historyBeginIdx + seriesSpan <= historySize
+                        ? 0
+                        : (historyBeginIdx + seriesSpan - historySize) / samplesPerValue;
+                    auto seriesEndIdx = (historyEndIdx + seriesSpan - historySize + samplesPerValue - 1) / samplesPerValue;
+                    historyBeginIdx = historyEndIdx;
+
+                    if (useMinMax) {
+                        GetSeriesExtremes(
+                            metric,
+                            series,
+                            (uint32_t) seriesBeginIdx,
+                            (uint32_t) seriesEndIdx,
+                            &minV,
+                            &v);
+                    } else {
+                        v = SumHistoryRange(
+                            series.mValues,
+                            (uint32_t) seriesBeginIdx,
+                            (uint32_t) seriesEndIdx) / (float) (seriesEndIdx - seriesBeginIdx);
+                    }
                 }
                 float b = baseValue[i];
                 v += b;
@@ -531,34 +2540,50 @@ void DrawMetrics(
                     inner_bb.Min.x + hScale * i,
                     inner_bb.Max.y - vScale * (v - plotMinValue));
 
-                if (i > 0) {
-                    if (plot->mBarGraph) {
+                if (plot->mBarGraph) {
+                    if (hasPrev) {
                         ImVec2 p1(
                             pn.x - plot->mVBarGapWidth,
                             inner_bb.Max.y - vScale * (prevB - plotMinValue));
                         p  = ImClamp(p,  inner_bb.Min, inner_bb.Max);
                         p1 = ImClamp(p1, inner_bb.Min, inner_bb.Max);
-                        window->DrawList->AddRectFilled(p, p1, color, plot->mBarRounding);
-                    } else {
-                        pn = ImClamp(pn, inner_bb.Min, inner_bb.Max);
-                        window->DrawList->AddLine(p, pn, color);
+                        if (p.y != p1.y) {
+                            points->emplace_back(p);
+                            points->emplace_back(p1);
+                        }
                     }
+                } else {
+                    // Offset by half a pixel like ImDrawList::AddLine()
+                    if (useMinMax && minV != v) {
+                        ImVec2 pmin(pn.x, inner_bb.Max.y - vScale * (minV - plotMinValue));
+                        line.AddPoint(ImClamp(pmin, inner_bb.Min, inner_bb.Max) + ImVec2(0.5f, 0.5f));
+                    }
+                    line.AddPoint(ImClamp(pn, inner_bb.Min, inner_bb.Max) + ImVec2(0.5f, 0.5f));
                 }
 
                 p = pn;
                 prevB = b;
+                hasPrev = true;
                 if (plot->mStacked) {
                     baseValue[i] = v;
                 }
             }
 
             if (plot->mBarGraph) {
-                ImVec2 p1(
-                    inner_bb.Max.x - plot->mVBarGapWidth,
-                    inner_bb.Max.y - vScale * (prevB - plotMinValue));
-                p  = ImClamp(p,  inner_bb.Min, inner_bb.Max);
-                p1 = ImClamp(p1, inner_bb.Min, inner_bb.Max);
-                window->DrawList->AddRectFilled(p, p1, color, plot->mBarRounding);
+                if (hasPrev) {
+                    ImVec2 p1(
+                        inner_bb.Max.x - plot->mVBarGapWidth,
+                        inner_bb.Max.y - vScale * (prevB - plotMinValue));
+                    p  = ImClamp(p,  inner_bb.Min, inner_bb.Max);
+                    p1 = ImClamp(p1, inner_bb.Min, inner_bb.Max);
+                    if (p.y != p1.y) {
+                        points->emplace_back(p);
+                        points->emplace_back(p1);
+                    }
+                }
+                DrawBars(window->DrawList, points, color, plot->mBarRounding);
+            } else {
+                DrawPolyline(window->DrawList, &line, color, plot->mThinLines);
             }
 
             if (plot->mShowAverage) {
@@ -570,16 +2595,33 @@ void DrawMetrics(
                     ImVec2(inner_bb.Max.x, y),
                     color);
             }
+
+            if (plot->mShowPercentiles && metric->mSortedHistory != nullptr) {
+                auto alpha = (color >> IM_COL32_A_SHIFT) & 0xFF;
+                auto percentileColor = (color & ~IM_COL32_A_MASK) | ((alpha / 2) << IM_COL32_A_SHIFT);
+                for (auto percentile : plot->mPercentiles) {
+                    auto y = inner_bb.Max.y - vScale * (metric->GetPercentileValue(percentile) - plotMinValue);
+                    y = ImClamp(y, inner_bb.Min.y, inner_bb.Max.y);
+                    window->DrawList->AddLine(
+                        ImVec2(inner_bb.Min.x, y),
+                        ImVec2(inner_bb.Max.x, y),
+                        percentileColor);
+                }
+            }
         }
     }
 
+    if (geometry != nullptr && !cached) {
+        RecordGeometry(geometry, drawList, vtxBegin, idxBegin, idxBase, inner_bb.Min);
+    }
+
     ImGui::SameLine();
 
     auto useSiUnitPrefix = false;
     auto units = "";
     if (plot->mShowLegendUnits) {
         useSiUnitPrefix = (metrics[0]->mFlags & MetricsGuiMetric::USE_SI_UNIT_PREFIX) != 0;
-        units = metrics[0]->mUnits.c_str();
+        units = metrics[0]->mUnits;
     }
 
 
@@ -593,6 +2635,7 @@ void DrawMetrics(
         // ---| Desc
         //    | Max: xxx
         //    | Avg: xxx
+        //    | Pnn: xxx
         //    | Min: xxx
         //    |
         // ---|
@@ -600,7 +2643,7 @@ void DrawMetrics(
             ImGui::PushStyleColor(ImGuiCol_Text, *(ImVec4*) &metrics[0]->mColor);
         }
         if (plot->mShowLegendDesc) {
-            ImGui::TextUnformatted(metrics[0]->mDescription.c_str());
+            ImGui::TextUnformatted(metrics[0]->mDescription);
         }
         if (plot->mShowLegendMax) {
             DrawQuantityLabel(plotMaxValue, units, "Max: ", useSiUnitPrefix);
@@ -611,6 +2654,9 @@ void DrawMetrics(
                 DrawQuantityLabel(plotAvgValue, units, "Avg: ", useSiUnitPrefix);
             }
         }
+        if (plot->mShowLegendPercentiles) {
+            DrawLegendPercentiles(plot, metrics[0], units, useSiUnitPrefix);
+        }
         if (plot->mShowLegendMin) {
             DrawQuantityLabel(plotMinValue, units, "Min: ", useSiUnitPrefix);
         }
@@ -621,39 +2667,43 @@ void DrawMetrics(
         // ---| Max: xxx
         //    | Desc
         //    | Avg: xxx
-        //    |
+        //    | Pnn: xxx
         //    |
         // ---| Min: xxx
         if (plot->mShowLegendMax) {
             DrawQuantityLabel(plotMaxValue, units, "Max: ", useSiUnitPrefix);
         }
-        if (plot->mShowLegendDesc || plot->mShowLegendAverage) {
+        if (plot->mShowLegendDesc || plot->mShowLegendAverage || plot->mShowLegendPercentiles) {
             // Order series based on value and/or stack order
-            std::vector<MetricsGuiMetric*> ordered(metrics.begin(), metrics.end());
+            auto ordered = AllocateFrameArray<MetricsGuiMetric*>(plot->mFrameArena, metrics.size());
+            auto orderedEnd = std::copy(metrics.begin(), metrics.end(), ordered);
             if (plot->mStacked) {
-                std::reverse(ordered.begin(), ordered.end());
+                std::reverse(ordered, orderedEnd);
             } else {
-                std::sort(ordered.begin(), ordered.end(), [](MetricsGuiMetric* a, MetricsGuiMetric* b) {
+                std::sort(ordered, orderedEnd, [](MetricsGuiMetric* a, MetricsGuiMetric* b) {
                     return b->GetAverageValue() < a->GetAverageValue();
                 });
             }
-            for (auto metric : ordered) {
+            for (auto metric : MetricRange(ordered, metrics.size())) {
                 if (plot->mShowLegendColor) {
                     ImGui::PushStyleColor(ImGuiCol_Text, *(ImVec4*) &metric->mColor);
                 }
                 if (plot->mShowLegendDesc) {
                     if (plot->mShowLegendAverage) {
                         char prefix[128];
-                        snprintf(prefix, _countof(prefix), "%s ", metric->mDescription.c_str());
+                        snprintf(prefix, _countof(prefix), "%s ", metric->mDescription);
                         auto plotAvgValue = metric->GetAverageValue();
                         DrawQuantityLabel(plotAvgValue, units, prefix, useSiUnitPrefix);
                     } else {
-                        ImGui::TextUnformatted(metric->mDescription.c_str());
+                        ImGui::TextUnformatted(metric->mDescription);
                     }
-                } else {
+                } else if (plot->mShowLegendAverage) {
                     auto plotAvgValue = metric->GetAverageValue();
                     DrawQuantityLabel(plotAvgValue, units, "Avg: ", useSiUnitPrefix);
                 }
+                if (plot->mShowLegendPercentiles) {
+                    DrawLegendPercentiles(plot, metric, units, useSiUnitPrefix);
+                }
                 if (plot->mShowLegendColor) {
                     ImGui::PopStyleColor();
                 }
@@ -697,13 +2747,13 @@ void MetricsGuiPlot::DrawList()
         // Draw description and value
         auto x = window->DC.CursorPos.x;
         auto y = window->DC.CursorPos.y;
-        ImGui::Selectable(metric->mDescription.c_str(), &metric->mSelected, ImGuiSelectableFlags_DrawFillAvailWidth);
+        ImGui::Selectable(metric->mDescription, &metric->mSelected, ImGuiSelectableFlags_DrawFillAvailWidth);
         if (valueX >= barStartX) {
             auto useSiUnitPrefix  = 0 != (metric->mFlags & MetricsGuiMetric::USE_SI_UNIT_PREFIX);
             auto lastValue = metric->GetLastValue();
             ImGui::SameLine(x + valueX - (window->Pos.x - window->Scroll.x));
 
-            DrawQuantityLabel(lastValue, metric->mUnits.c_str(), "", useSiUnitPrefix);
+            DrawQuantityLabel(lastValue, metric->mUnits, "", useSiUnitPrefix);
 
             // Draw bar
             if (barEndX > barStartX) {
@@ -724,8 +2774,7 @@ void MetricsGuiPlot::DrawList()
 
         if (mShowInlineGraphs &&
             (!mShowOnlyIfSelected || metric->mSelected)) {
-            std::vector<MetricsGuiMetric*> m(1, metric);
-            DrawMetrics(this, m, mInlinePlotRowCount, metricRange.first, metricRange.second);
+            DrawMetrics(this, MetricRange(&mMetrics[i], 1), mInlinePlotRowCount, metricRange.first, metricRange.second, nullptr);
         }
     }
 
@@ -738,6 +2787,117 @@ void MetricsGuiPlot::DrawHistory()
         return;
     }
 
-    DrawMetrics(this, mMetrics, mPlotRowCount, mMinValue, mMaxValue);
+    DrawMetrics(this, mMetrics, mPlotRowCount, mMinValue, mMaxValue, mGeometry);
+}
+
+void MetricsGuiPlot::DrawHistogram()
+{
+    if (!DrawPrefix(this)) {
+        return;
+    }
+
+    ImRect frame_bb;
+    ImRect inner_bb;
+    if (!AddPlotFrame(this, mPlotRowCount, &frame_bb, &inner_bb)) {
+        return;
+    }
+
+    // Metrics' bars are drawn side by side within each bin
+    auto window = ImGui::GetCurrentWindow();
+    uint32_t histogramCount = 0;
+    uint32_t binCount = 0;
+    uint32_t maxCount = 0;
+    MetricsGuiMetric const* firstMetric = nullptr;
+    for (auto metric : mMetrics) {
+        if (metric->mHistogram.mCounts.empty() || (mShowOnlyIfSelected && !metric->mSelected)) {
+            continue;
+        }
+        if (firstMetric == nullptr) {
+            firstMetric = metric;
+        }
+        histogramCount += 1;
+        binCount = std::max(binCount, (uint32_t) metric->mHistogram.mCounts.size());
+        for (auto count : metric->mHistogram.mCounts) {
+            maxCount = std::max(maxCount, count);
+        }
+    }
+
+    if (maxCount > 0) {
+        auto binWidth = inner_bb.GetWidth() / binCount;
+        auto barWidth = std::max(1.f, (binWidth - mVBarGapWidth) / histogramCount);
+        auto vScale = inner_bb.GetHeight() / maxCount;
+        uint32_t barIndex = 0;
+        for (auto metric : mMetrics) {
+            if (metric->mHistogram.mCounts.empty() || (mShowOnlyIfSelected && !metric->mSelected)) {
+                continue;
+            }
+
+            auto color = ImGui::ColorConvertFloat4ToU32(*(ImVec4*) &metric->mColor);
+            auto const& counts = metric->mHistogram.mCounts;
+            auto metricBinWidth = inner_bb.GetWidth() / counts.size();
+            for (size_t i = 0, N = counts.size(); i < N; ++i) {
+                if (counts[i] == 0) {
+                    continue;
+                }
+                auto x = inner_bb.Min.x + metricBinWidth * i + barWidth * barIndex;
+                ImVec2 p0(x, inner_bb.Max.y - vScale * counts[i]);
+                ImVec2 p1(x + barWidth, inner_bb.Max.y);
+                window->DrawList->AddRectFilled(
+                    ImClamp(p0, inner_bb.Min, inner_bb.Max),
+                    ImClamp(p1, inner_bb.Min, inner_bb.Max),
+                    color,
+                    mBarRounding);
+            }
+            barIndex += 1;
+        }
+    }
+
+    ImGui::SameLine();
+
+    // ---| Desc
+    //    | Hi: xxx
+    //    |
+    //    |
+    // ---| Lo: xxx
+    ImGui::BeginGroup();
+    ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, ImVec2(0.f, LEGEND_TEXT_VERTICAL_SPACING));
+
+    if (mShowLegendDesc) {
+        for (auto metric : mMetrics) {
+            if (metric->mHistogram.mCounts.empty() || (mShowOnlyIfSelected && !metric->mSelected)) {
+                continue;
+            }
+            if (mShowLegendColor) {
+                ImGui::PushStyleColor(ImGuiCol_Text, *(ImVec4*) &metric->mColor);
+            }
+            ImGui::TextUnformatted(metric->mDescription);
+            if (mShowLegendColor) {
+                ImGui::PopStyleColor();
+            }
+        }
+    }
+
+    if (firstMetric != nullptr) {
+        auto useSiUnitPrefix = false;
+        auto units = "";
+        if (mShowLegendUnits) {
+            useSiUnitPrefix = (firstMetric->mFlags & MetricsGuiMetric::USE_SI_UNIT_PREFIX) != 0;
+            units = firstMetric->mUnits;
+        }
+        if (mShowLegendMax) {
+            DrawQuantityLabel(firstMetric->mHistogram.mEdges.back(), units, "Hi: ", useSiUnitPrefix);
+        }
+        if (mShowLegendMin) {
+            auto cy = window->DC.CursorPos.y;
+            auto ty = frame_bb.Max.y - ImGui::GetTextLineHeight();
+            if (cy < ty) {
+                ImGui::ItemSize(ImVec2(0.f, ty - cy));
+            }
+            DrawQuantityLabel(firstMetric->mHistogram.mEdges.front(), units, "Lo: ", useSiUnitPrefix);
+        }
+    }
+
+    ImGui::PopStyleVar(1);
+    ImGui::EndGroup();
 }
 
@@ -0,0 +1,271 @@
+/*
+Copyright 2017 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "../include/metrics_gui/metrics_gui.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <mutex>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
+namespace {
+
+// Strings are copied into fixed-size chunks which are never freed or moved,
+// so interned pointers stay valid for the life of the process.  Strings
+// longer than a chunk get a chunk of their own.
+struct StringPool {
+    enum { CHUNK_SIZE = 4096 };
+
+    std::vector<char const*> mSlots;    // Power-of-two size, linear probing
+    std::vector<uint32_t> mHashes;
+    uint32_t mCount;
+    std::vector<char*> mChunks;
+    char* mNext;
+    size_t mRemaining;
+
+    StringPool()
+        : mCount(0)
+        , mNext(nullptr)
+        , mRemaining(0)
+    {
+        mSlots.resize(256, nullptr);
+        mHashes.resize(256, 0);
+    }
+
+    ~StringPool()
+    {
+        for (auto chunk : mChunks) {
+            free(chunk);
+        }
+    }
+
+    char const* Copy(
+        char const* s,
+        size_t size)
+    {
+        if (size > mRemaining) {
+            auto chunkSize = size > CHUNK_SIZE ? size : (size_t) CHUNK_SIZE;
+            auto chunk = (char*) malloc(chunkSize);
+            mChunks.emplace_back(chunk);
+            if (size > CHUNK_SIZE) {
+                memcpy(chunk, s, size);
+                return chunk;
+            }
+            mNext = chunk;
+            mRemaining = chunkSize;
+        }
+        auto copy = mNext;
+        memcpy(copy, s, size);
+        mNext += size;
+        mRemaining -= size;
+        return copy;
+    }
+
+    void Grow()
+    {
+        std::vector<char const*> slots(mSlots.size() * 2, nullptr);
+        std::vector<uint32_t> hashes(slots.size(), 0);
+        auto mask = (uint32_t) slots.size() - 1;
+        for (size_t i = 0, N = mSlots.size(); i < N; ++i) {
+            if (mSlots[i] == nullptr) continue;
+            auto j = mHashes[i] & mask;
+            while (slots[j] != nullptr) {
+                j = (j + 1) & mask;
+            }
+            slots[j] = mSlots[i];
+            hashes[j] = mHashes[i];
+        }
+        mSlots.swap(slots);
+        mHashes.swap(hashes);
+    }
+
+    char const* Intern(
+        char const* s)
+    {
+        auto hash = MetricsGuiRegistry::Hash(s);
+        auto mask = (uint32_t) mSlots.size() - 1;
+        auto i = hash & mask;
+        for (; mSlots[i] != nullptr; i = (i + 1) & mask) {
+            if (mHashes[i] == hash && strcmp(mSlots[i], s) == 0) {
+                return mSlots[i];
+            }
+        }
+
+        auto copy = Copy(s, strlen(s) + 1);
+        mSlots[i] = copy;
+        mHashes[i] = hash;
+
+        // Keep the load factor at or below 1/2.
+        mCount += 1;
+        if (mCount * 2 > mSlots.size()) {
+            Grow();
+        }
+        return copy;
+    }
+};
+
+StringPool& GetStringPool()
+{
+    static StringPool pool;
+    return pool;
+}
+
+std::mutex& GetStringPoolMutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+}
+
+MetricsGuiRegistry::MetricsGuiRegistry()
+    : mOwnedCount(0)
+{
+    mSlots.resize(64, Slot{ nullptr, 0 });
+}
+
+MetricsGuiRegistry::~MetricsGuiRegistry()
+{
+    for (uint32_t i = 0; i < mOwnedCount; ++i) {
+        mBlocks[i / METRICS_PER_BLOCK][i % METRICS_PER_BLOCK].~MetricsGuiMetric();
+    }
+    for (auto block : mBlocks) {
+        operator delete(block);
+    }
+}
+
+MetricsGuiMetric* MetricsGuiRegistry::AddMetric(
+    char const* description,
+    char const* units,
+    uint32_t flags,
+    uint32_t historySize)
+{
+    auto metric = FindMetric(description);
+    if (metric == nullptr) {
+        // Blocks are never moved, so metric pointers stay valid.
+        if (mOwnedCount == mBlocks.size() * METRICS_PER_BLOCK) {
+            mBlocks.emplace_back((MetricsGuiMetric*) operator new(METRICS_PER_BLOCK * sizeof(MetricsGuiMetric)));
+        }
+        metric = &mBlocks[mOwnedCount / METRICS_PER_BLOCK][mOwnedCount % METRICS_PER_BLOCK];
+        new (metric) MetricsGuiMetric(description, units, flags, historySize);
+        mOwnedCount += 1;
+        RegisterMetric(metric);
+    }
+    return metric;
+}
+
+bool MetricsGuiRegistry::RegisterMetric(
+    MetricsGuiMetric* metric)
+{
+    auto hash = Hash(metric->mDescription);
+    auto mask = (uint32_t) mSlots.size() - 1;
+    auto i = hash & mask;
+    for (; mSlots[i].mMetric != nullptr; i = (i + 1) & mask) {
+        // Descriptions set with Initialize() are interned, so equal pointers
+        // are equal strings, but one assigned directly may not be.
+        auto description = mSlots[i].mMetric->mDescription;
+        if (description == metric->mDescription ||
+            (mSlots[i].mHash == hash && strcmp(description, metric->mDescription) == 0)) {
+            return false;
+        }
+    }
+
+    mSlots[i].mMetric = metric;
+    mSlots[i].mHash = hash;
+    mMetrics.emplace_back(metric);
+
+    // Keep the load factor at or below 1/2, so misses stay short.
+    if (mMetrics.size() * 2 > mSlots.size()) {
+        std::vector<Slot> slots(mSlots.size() * 2, Slot{ nullptr, 0 });
+        mask = (uint32_t) slots.size() - 1;
+        for (auto const& slot : mSlots) {
+            if (slot.mMetric == nullptr) continue;
+            auto j = slot.mHash & mask;
+            while (slots[j].mMetric != nullptr) {
+                j = (j + 1) & mask;
+            }
+            slots[j] = slot;
+        }
+        mSlots.swap(slots);
+    }
+    return true;
+}
+
+bool MetricsGuiRegistry::UnregisterMetric(
+    MetricsGuiMetric* metric)
+{
+    auto mask = (uint32_t) mSlots.size() - 1;
+    auto i = Hash(metric->mDescription) & mask;
+    for (; mSlots[i].mMetric != metric; i = (i + 1) & mask) {
+        if (mSlots[i].mMetric == nullptr) {
+            return false;
+        }
+    }
+
+    // Move later slots of the same probe sequences back into the hole, so
+    // that lookups passing over it still find them.  A slot can fill the hole
+    // unless its home slot lies cyclically after the hole.
+    auto hole = i;
+    for (auto j = (i + 1) & mask; mSlots[j].mMetric != nullptr; j = (j + 1) & mask) {
+        auto home = mSlots[j].mHash & mask;
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            mSlots[hole] = mSlots[j];
+            hole = j;
+        }
+    }
+    mSlots[hole] = Slot{ nullptr, 0 };
+    mMetrics.erase(std::find(mMetrics.begin(), mMetrics.end(), metric));
+    return true;
+}
+
+MetricsGuiMetric* MetricsGuiRegistry::FindMetric(
+    char const* description) const
+{
+    auto hash = Hash(description);
+    auto mask = (uint32_t) mSlots.size() - 1;
+    for (auto i = hash & mask; mSlots[i].mMetric != nullptr; i = (i + 1) & mask) {
+        if (mSlots[i].mHash == hash && strcmp(mSlots[i].mMetric->mDescription, description) == 0) {
+            return mSlots[i].mMetric;
+        }
+    }
+    return nullptr;
+}
+
+char const* MetricsGuiRegistry::Intern(
+    char const* s)
+{
+    std::lock_guard<std::mutex> lock(GetStringPoolMutex());
+    return GetStringPool().Intern(s);
+}
+
+// 32-bit FNV-1a
+uint32_t MetricsGuiRegistry::Hash(
+    char const* s)
+{
+    uint32_t hash = 2166136261u;
+    for (; *s != '\0'; ++s) {
+        hash = (hash ^ (uint8_t) *s) * 16777619u;
+    }
+    return hash;
+}
@@ -0,0 +1,482 @@
+/*
+Copyright 2017 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "../../imgui/imgui.h"
+#define IMGUI_DEFINE_MATH_OPERATORS
+#include "../../imgui/imgui_internal.h"
+#include "../include/metrics_gui/zone.h"
+#include "../../portable/countof.h"
+#include "../../portable/snprintf.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <mutex>
+#include <new>
+#include <stdlib.h>
+#include <string>
+
+namespace {
+
+float const ZONE_ROW_SPACING = 2.f;
+
+std::mutex& GetRecordersMutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+std::vector<MetricsGuiZoneRecorder*>& GetRecorderList()
+{
+    static std::vector<MetricsGuiZoneRecorder*> recorders;
+    return recorders;
+}
+
+// Releases the thread's recorder when the thread exits
+struct ThreadRecorderRelease {
+    MetricsGuiZoneRecorder* mRecorder;
+
+    ~ThreadRecorderRelease()
+    {
+        if (mRecorder != nullptr) {
+            std::lock_guard<std::mutex> lock(GetRecordersMutex());
+            mRecorder->mInUse = false;
+        }
+    }
+};
+
+std::mutex& GetShardIndicesMutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+// Shard indices released by exited threads, and the next index never used
+std::vector<uint32_t>& GetFreeShardIndices()
+{
+    static std::vector<uint32_t> indices;
+    return indices;
+}
+
+uint32_t& GetNextShardIndex()
+{
+    static uint32_t index = 0;
+    return index;
+}
+
+// Releases the thread's shard index when the thread exits
+struct ThreadShardIndexRelease {
+    uint32_t mIndex;
+
+    ~ThreadShardIndexRelease()
+    {
+        if (mIndex != MetricsGuiZoneThread::NO_SHARD) {
+            std::lock_guard<std::mutex> lock(GetShardIndicesMutex());
+            GetFreeShardIndices().emplace_back(mIndex);
+        }
+    }
+};
+
+void DrawZoneBar(
+    ImDrawList* drawList,
+    ImRect const& bar,
+    ImU32 color,
+    char const* label,
+    uint64_t ticks,
+    uint32_t count,
+    bool hovered)
+{
+    drawList->AddRectFilled(bar.Min, bar.Max, color);
+    if (label != nullptr && bar.GetWidth() > ImGui::GetTextLineHeight()) {
+        ImGui::RenderTextClipped(
+            ImVec2(bar.Min.x + ZONE_ROW_SPACING, bar.Min.y),
+            ImVec2(bar.Max.x - ZONE_ROW_SPACING, bar.Max.y),
+            label, nullptr, nullptr);
+    }
+
+    if (hovered && bar.Contains(ImGui::GetIO().MousePos)) {
+        auto frequency = GetPerfTimerFrequency();
+        auto ms = 1000. * ticks * frequency.Denominator / frequency.Numerator;
+        if (count == 1) {
+            ImGui::SetTooltip("%s: %.3f ms", label, ms);
+        } else {
+            ImGui::SetTooltip("%u zones: %.3f ms", count, ms);
+        }
+    }
+}
+
+} // anon namespace
+
+uint32_t MetricsGuiZoneThread::AcquireShardIndex()
+{
+    static thread_local ThreadShardIndexRelease release = { NO_SHARD };
+
+    // Reuse the lowest free index, so that threads keep to the shards every
+    // zone has while fewer than that many are running.
+    std::lock_guard<std::mutex> lock(GetShardIndicesMutex());
+    auto& freeIndices = GetFreeShardIndices();
+    if (freeIndices.empty()) {
+        release.mIndex = GetNextShardIndex()++;
+    } else {
+        auto lowest = std::min_element(freeIndices.begin(), freeIndices.end());
+        release.mIndex = *lowest;
+        *lowest = freeIndices.back();
+        freeIndices.pop_back();
+    }
+    return release.mIndex;
+}
+
+MetricsGuiZone::MetricsGuiZone(
+    char const* description,
+    uint32_t flags,
+    uint32_t historySize,
+    uint32_t shardCount)
+    : MetricsGuiMetric(description, "s", flags, historySize)
+    , mSelfMetric((std::string(description) + " (self)").c_str(), "s", flags, historySize)
+{
+    assert(shardCount > 0);
+
+    // Align the shards to a cache line so that each shard is in its own line
+    mShardCount = shardCount;
+    mShardMemory = malloc((shardCount + 1) * sizeof(Shard) + 63);
+    mShards = (Shard*) (((uintptr_t) mShardMemory + 63) & ~(uintptr_t) 63);
+    for (uint32_t i = 0; i <= shardCount; ++i) {
+        new (&mShards[i]) Shard;
+        mShards[i].mTicks.store(0, std::memory_order_relaxed);
+        mShards[i].mSelfTicks.store(0, std::memory_order_relaxed);
+    }
+
+    mPackedColor.store(ImGui::ColorConvertFloat4ToU32(*(ImVec4*) &mColor), std::memory_order_relaxed);
+
+    auto frequency = GetPerfTimerFrequency();
+    mSecondsPerTick = (double) frequency.Denominator / (double) frequency.Numerator;
+    mCommittedTicks = 0;
+    mCommittedSelfTicks = 0;
+}
+
+MetricsGuiZone::~MetricsGuiZone()
+{
+    for (uint32_t i = 0; i <= mShardCount; ++i) {
+        mShards[i].~Shard();
+    }
+    free(mShardMemory);
+}
+
+void MetricsGuiZone::Commit()
+{
+    // The shards' totals only grow, as their threads can't be interrupted to
+    // reset them.
+    uint64_t ticks = 0;
+    uint64_t selfTicks = 0;
+    for (uint32_t i = 0; i <= mShardCount; ++i) {
+        ticks += mShards[i].mTicks.load(std::memory_order_relaxed);
+        selfTicks += mShards[i].mSelfTicks.load(std::memory_order_relaxed);
+    }
+    AddNewValue((float) ((ticks - mCommittedTicks) * mSecondsPerTick));
+    mSelfMetric.AddNewValue((float) ((selfTicks - mCommittedSelfTicks) * mSecondsPerTick));
+    mCommittedTicks = ticks;
+    mCommittedSelfTicks = selfTicks;
+
+    // Timers on other threads read the color, so they see it packed
+    mPackedColor.store(ImGui::ColorConvertFloat4ToU32(*(ImVec4*) &mColor), std::memory_order_relaxed);
+}
+
+MetricsGuiZoneRecorder* MetricsGuiZoneRecorder::AcquireRecorder()
+{
+    static thread_local ThreadRecorderRelease release = { nullptr };
+
+    std::lock_guard<std::mutex> lock(GetRecordersMutex());
+    auto& recorders = GetRecorderList();
+    for (auto recorder : recorders) {
+        if (!recorder->mInUse) {
+            recorder->mInUse = true;
+            release.mRecorder = recorder;
+            return recorder;
+        }
+    }
+
+    auto ring = new EventRing;
+    ring->mEvents = new Event[MIN_EVENTS];
+    ring->mMask = MIN_EVENTS - 1;
+    ring->mFirstIndex = 0;
+
+    auto recorder = new MetricsGuiZoneRecorder;
+    recorder->mRing.store(ring, std::memory_order_relaxed);
+    recorder->mClaimCount.store(0, std::memory_order_relaxed);
+    recorder->mWriteCount.store(0, std::memory_order_relaxed);
+    recorder->mThreadIndex = (uint32_t) recorders.size();
+    recorder->mInUse = true;
+    recorders.emplace_back(recorder);
+    release.mRecorder = recorder;
+    return recorder;
+}
+
+void MetricsGuiZoneRecorder::GetRecorders(
+    std::vector<MetricsGuiZoneRecorder*>* recorders)
+{
+    std::lock_guard<std::mutex> lock(GetRecordersMutex());
+    *recorders = GetRecorderList();
+}
+
+MetricsGuiZoneRecorder::EventRing* MetricsGuiZoneRecorder::Grow(
+    uint64_t writeCount)
+{
+    auto oldRing = mRing.load(std::memory_order_relaxed);
+    auto oldSize = (uint64_t) oldRing->mMask + 1;
+
+    auto ring = new EventRing;
+    ring->mEvents = new Event[oldSize * 2];
+    ring->mMask = (uint32_t) (oldSize * 2 - 1);
+    ring->mFirstIndex = std::max(oldRing->mFirstIndex, writeCount - oldSize);
+    for (auto i = ring->mFirstIndex; i < writeCount; ++i) {
+        auto const& src = oldRing->mEvents[i & oldRing->mMask];
+        auto& dst = ring->mEvents[i & ring->mMask];
+        dst.mDescription.store(src.mDescription.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        dst.mBeginTicks.store(src.mBeginTicks.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        dst.mEndTicks.store(src.mEndTicks.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        dst.mDepth.store(src.mDepth.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        dst.mColor.store(src.mColor.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+
+    mRetiredRings.emplace_back(oldRing);
+    mRing.store(ring, std::memory_order_release);
+    return ring;
+}
+
+uint32_t MetricsGuiZoneRecorder::Read(
+    uint64_t beginTicks,
+    uint64_t endTicks,
+    std::vector<MetricsGuiZoneEvent>* events) const
+{
+    // The ring is loaded after mWriteCount, so it holds at least the events
+    // before writeCount that have not been overwritten
+    auto writeCount = mWriteCount.load(std::memory_order_acquire);
+    auto ring = mRing.load(std::memory_order_acquire);
+    auto size = (uint64_t) ring->mMask + 1;
+    auto firstIndex = std::max(ring->mFirstIndex, writeCount < size ? 0 : writeCount - size);
+
+    // Events are ordered by end time, so find the first one ending after
+    // beginTicks with a binary search
+    auto lo = firstIndex;
+    auto hi = writeCount;
+    while (lo < hi) {
+        auto mid = lo + (hi - lo) / 2;
+        if (ring->mEvents[mid & ring->mMask].mEndTicks.load(std::memory_order_relaxed) <= beginTicks) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    // Later events can still begin before endTicks if they enclose it, but
+    // not once a top-level event begins after it: later events are either
+    // nested in that event or begin after it ends.
+    auto eventCount = events->size();
+    uint32_t depthCount = 0;
+    for (auto i = lo; i < writeCount; ++i) {
+        auto const& event = ring->mEvents[i & ring->mMask];
+        MetricsGuiZoneEvent e;
+        e.mBeginTicks = event.mBeginTicks.load(std::memory_order_relaxed);
+        e.mDepth = event.mDepth.load(std::memory_order_relaxed);
+        if (e.mBeginTicks >= endTicks) {
+            if (e.mDepth == 0) {
+                break;
+            }
+            continue;
+        }
+        e.mDescription = event.mDescription.load(std::memory_order_relaxed);
+        e.mEndTicks = event.mEndTicks.load(std::memory_order_relaxed);
+        e.mColor = event.mColor.load(std::memory_order_relaxed);
+        events->emplace_back(e);
+        depthCount = std::max(depthCount, e.mDepth + 1);
+
+        // Nor after a top-level event that encloses endTicks
+        if (e.mDepth == 0 && e.mEndTicks >= endTicks) {
+            break;
+        }
+    }
+
+    // If the thread overwrote any of the events while they were being read,
+    // discard them all; the thread is recording too quickly for the ring
+    // buffer to hold a frame anyway.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (mClaimCount.load(std::memory_order_relaxed) > lo + size) {
+        events->resize(eventCount);
+        return 0;
+    }
+    return depthCount;
+}
+
+MetricsGuiTimeline::MetricsGuiTimeline()
+    : mFrameHead(0)
+    , mFrameCount(0)
+    , mSelectedFrame(0)
+    , mMinZoneWidth(1.f)
+{
+    MetricsGuiZoneRecorder::GetRecordingEnabled().store(true, std::memory_order_relaxed);
+}
+
+void MetricsGuiTimeline::MarkFrame()
+{
+    mFrameTicks[mFrameHead] = GetPerfTimerCount();
+    mFrameHead = mFrameHead + 1 == NUM_FRAMES ? 0 : mFrameHead + 1;
+    mFrameCount = std::min((uint32_t) NUM_FRAMES, mFrameCount + 1);
+
+    // Keep the events of the selected frame and every frame after it
+    if (mFrameCount >= 2) {
+        auto selectedFrame = std::min(mSelectedFrame, mFrameCount - 2);
+        auto newestIndex = mFrameHead + NUM_FRAMES - 1;
+        MetricsGuiZoneRecorder::GetRetainTicks().store(
+            mFrameTicks[(newestIndex - selectedFrame - 1) % NUM_FRAMES],
+            std::memory_order_relaxed);
+    }
+}
+
+void MetricsGuiTimeline::DrawTimeline()
+{
+    auto window = ImGui::GetCurrentWindow();
+    if (window->SkipItems) {
+        return;
+    }
+
+    auto const& style = GImGui->Style;
+    auto rowHeight = ImGui::GetTextLineHeight() + ZONE_ROW_SPACING;
+
+    // The selected frame lasts until the start of the next frame
+    uint64_t beginTicks = 0;
+    uint64_t endTicks = 0;
+    if (mFrameCount >= 2) {
+        auto selectedFrame = std::min(mSelectedFrame, mFrameCount - 2);
+        auto newestIndex = mFrameHead + NUM_FRAMES - 1;
+        endTicks   = mFrameTicks[(newestIndex - selectedFrame) % NUM_FRAMES];
+        beginTicks = mFrameTicks[(newestIndex - selectedFrame - 1) % NUM_FRAMES];
+    }
+
+    // Gather each thread's events into a lane
+    mEvents.clear();
+    mLanes.clear();
+    uint32_t rowCount = 0;
+    if (endTicks > beginTicks) {
+        MetricsGuiZoneRecorder::GetRecorders(&mRecorders);
+        for (auto recorder : mRecorders) {
+            Lane lane;
+            lane.mThreadIndex = recorder->mThreadIndex;
+            lane.mEventBegin = (uint32_t) mEvents.size();
+            lane.mDepthCount = recorder->Read(beginTicks, endTicks, &mEvents);
+            lane.mEventEnd = (uint32_t) mEvents.size();
+            if (lane.mEventEnd > lane.mEventBegin) {
+                mLanes.emplace_back(lane);
+                rowCount += 1 + lane.mDepthCount;
+            }
+        }
+    }
+
+    ImRect frame_bb(
+        window->DC.CursorPos,
+        window->DC.CursorPos + ImVec2(ImGui::GetContentRegionAvailWidth(), rowHeight * rowCount + 2.f * style.FramePadding.y));
+    ImRect inner_bb(
+        frame_bb.Min + style.FramePadding,
+        frame_bb.Max - style.FramePadding);
+
+    ImGui::ItemSize(frame_bb, style.FramePadding.y);
+    if (!ImGui::ItemAdd(frame_bb, 0)) {
+        return;
+    }
+
+    ImGui::RenderFrame(frame_bb.Min, frame_bb.Max, ImGui::GetColorU32(ImGuiCol_FrameBg), true, style.FrameRounding);
+    if (mLanes.empty()) {
+        return;
+    }
+
+    auto drawList = window->DrawList;
+    auto textColor = ImGui::GetColorU32(ImGuiCol_Text);
+    auto mergedColor = ImGui::GetColorU32(ImGuiCol_TextDisabled);
+    auto hovered = ImGui::IsItemHovered();
+    auto xScale = inner_bb.GetWidth() / (float) (endTicks - beginTicks);
+
+    // A run is drawn once no more narrow zones can be merged into it, and
+    // culled if it is still narrower than mMinZoneWidth
+    auto drawRun = [&](Run* run, float y) {
+        if (run->mCount > 0 && run->mX1 - run->mX0 >= mMinZoneWidth) {
+            DrawZoneBar(
+                drawList,
+                ImRect(run->mX0, y + 1.f, run->mX1, y + rowHeight - 1.f),
+                run->mCount == 1 ? run->mColor : mergedColor,
+                run->mCount == 1 ? run->mDescription : nullptr,
+                run->mTicks,
+                run->mCount,
+                hovered);
+        }
+        run->mCount = 0;
+    };
+
+    char label[32];
+    auto y = inner_bb.Min.y;
+    for (auto const& lane : mLanes) {
+        snprintf(label, _countof(label), "Thread %u", lane.mThreadIndex);
+        drawList->AddText(ImVec2(inner_bb.Min.x, y), textColor, label);
+        y += rowHeight;
+
+        mRuns.assign(lane.mDepthCount, Run());
+        for (auto i = lane.mEventBegin; i < lane.mEventEnd; ++i) {
+            auto const& event = mEvents[i];
+            // (Converting signed integers to float is faster than unsigned.)
+            auto x0 = inner_bb.Min.x + xScale * (float) (int64_t) (std::max(event.mBeginTicks, beginTicks) - beginTicks);
+            auto x1 = inner_bb.Min.x + xScale * (float) (int64_t) (std::min(event.mEndTicks, endTicks) - beginTicks);
+            auto rowY = y + rowHeight * event.mDepth;
+            auto ticks = event.mEndTicks - event.mBeginTicks;
+
+            // Events at the same depth are in time order, so narrow zones
+            // can be merged into the pending run at their depth
+            auto run = &mRuns[event.mDepth];
+            if (x1 - x0 < mMinZoneWidth) {
+                if (run->mCount > 0 && x0 - run->mX1 < mMinZoneWidth) {
+                    run->mX1 = std::max(run->mX1, x1);
+                    run->mTicks += ticks;
+                    run->mCount += 1;
+                } else {
+                    drawRun(run, rowY);
+                    run->mDescription = event.mDescription;
+                    run->mColor = event.mColor;
+                    run->mTicks = ticks;
+                    run->mX0 = x0;
+                    run->mX1 = x1;
+                    run->mCount = 1;
+                }
+                continue;
+            }
+
+            drawRun(run, rowY);
+            DrawZoneBar(
+                drawList,
+                ImRect(x0, rowY + 1.f, x1, rowY + rowHeight - 1.f),
+                event.mColor,
+                event.mDescription,
+                ticks,
+                1,
+                hovered);
+        }
+        for (uint32_t depth = 0; depth < lane.mDepthCount; ++depth) {
+            drawRun(&mRuns[depth], y + rowHeight * depth);
+        }
+        y += rowHeight * lane.mDepthCount;
+    }
+}
@@ -19,8 +19,28 @@ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
 OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
+
+// GetPerfTimerCount() returns a monotonic count of timer ticks, and
+// GetPerfTimerFrequency() returns the number of ticks per second as the
+// ratio Numerator / Denominator.
+//
+// Define PERF_TIMER_USE_TSC to read the x86 time-stamp counter directly,
+// which avoids the OS call.  The TSC frequency is calibrated against the OS
+// timer on the first call to GetPerfTimerFrequency(), so call it during
+// startup.  Only use the TSC on CPUs with an invariant TSC (see
+// IsInvariantTscSupported()), as otherwise its rate varies with power state
+// and it may differ between cores.
+//
+// Whichever is selected, the OS timer can be read with GetOsPerfTimerCount()
+// and, on x86, the TSC with GetTscPerfTimerCount().
+
+#ifndef PERF_TIMER_H
+#define PERF_TIMER_H
+
 #ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
 #define WIN32_LEAN_AND_MEAN
+#endif
 #include <stdint.h>
 #include <windows.h>
 
@@ -29,20 +49,20 @@ struct PerfTimerFrequency {
     enum { Denominator = 1 };
 };
 
-inline uint64_t GetPerfTimerCount()
+inline uint64_t GetOsPerfTimerCount()
 {
     LARGE_INTEGER t;
     QueryPerformanceCounter(&t);
     return t.QuadPart;
 }
 
-inline PerfTimerFrequency GetPerfTimerFrequency()
+inline PerfTimerFrequency GetOsPerfTimerFrequency()
 {
     PerfTimerFrequency f;
     QueryPerformanceFrequency((LARGE_INTEGER*) &f.Numerator);
     return f;
 }
-#else // ifdef _WIN32
+#elif defined(__APPLE__) // ifdef _WIN32
 #include <mach/mach_time.h>
 #include <stdint.h>
 
@@ -51,12 +71,12 @@ struct PerfTimerFrequency {
     uint32_t Denominator;
 };
 
-inline uint64_t GetPerfTimerCount()
+inline uint64_t GetOsPerfTimerCount()
 {
     return mach_absolute_time();
 }
 
-inline PerfTimerFrequency GetPerfTimerFrequency()
+inline PerfTimerFrequency GetOsPerfTimerFrequency()
 {
     mach_timebase_info_data_t i;
     mach_timebase_info(&i);
@@ -66,4 +86,114 @@ inline PerfTimerFrequency GetPerfTimerFrequency()
     f.Denominator = i.numer;
     return f;
 }
+#else // ifdef _WIN32
+#include <stdint.h>
+#include <time.h>
+
+struct PerfTimerFrequency {
+    uint64_t Numerator;
+    enum { Denominator = 1 };
+};
+
+// CLOCK_MONOTONIC_RAW is not slewed by NTP, so intervals measure the
+// hardware clock rate.
+inline uint64_t GetOsPerfTimerCount()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &t);
+    return (uint64_t) t.tv_sec * 1000000000ull + (uint64_t) t.tv_nsec;
+}
+
+inline PerfTimerFrequency GetOsPerfTimerFrequency()
+{
+    PerfTimerFrequency f;
+    f.Numerator = 1000000000ull;
+    return f;
+}
 #endif // ifdef _WIN32
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PERF_TIMER_HAS_TSC
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+inline bool IsInvariantTscSupported()
+{
+    // CPUID.80000007H:EDX[8]
+    unsigned int r[4] = {};
+#ifdef _MSC_VER
+    __cpuid((int*) r, 0x80000000);
+    if (r[0] < 0x80000007) {
+        return false;
+    }
+    __cpuid((int*) r, 0x80000007);
+#else
+    if (__get_cpuid_max(0x80000000, nullptr) < 0x80000007) {
+        return false;
+    }
+    __get_cpuid(0x80000007, &r[0], &r[1], &r[2], &r[3]);
+#endif
+    return (r[3] & (1u << 8)) != 0;
+}
+
+// Count TSC ticks over about 10ms of the OS timer.
+inline PerfTimerFrequency CalibrateTscFrequency()
+{
+    auto osFrequency = GetOsPerfTimerFrequency();
+    auto osDuration = osFrequency.Numerator / osFrequency.Denominator / 100;
+
+    auto os0 = GetOsPerfTimerCount();
+    auto tsc0 = __rdtsc();
+    uint64_t os1;
+    do {
+        os1 = GetOsPerfTimerCount();
+    } while (os1 - os0 < osDuration);
+    auto tsc1 = __rdtsc();
+
+    PerfTimerFrequency f = osFrequency;
+    f.Numerator = (uint64_t) ((double) (tsc1 - tsc0) * osFrequency.Numerator / ((double) (os1 - os0) * osFrequency.Denominator));
+#ifdef __APPLE__
+    f.Denominator = 1;
+#endif
+    return f;
+}
+
+inline uint64_t GetTscPerfTimerCount()
+{
+    return __rdtsc();
+}
+
+inline PerfTimerFrequency GetTscPerfTimerFrequency()
+{
+    static PerfTimerFrequency const f = CalibrateTscFrequency();
+    return f;
+}
+#endif // if defined(_M_X64) || ...
+
+#if defined(PERF_TIMER_USE_TSC) && defined(PERF_TIMER_HAS_TSC)
+inline uint64_t GetPerfTimerCount()
+{
+    return GetTscPerfTimerCount();
+}
+
+inline PerfTimerFrequency GetPerfTimerFrequency()
+{
+    return GetTscPerfTimerFrequency();
+}
+#else // if defined(PERF_TIMER_USE_TSC) && ...
+inline uint64_t GetPerfTimerCount()
+{
+    return GetOsPerfTimerCount();
+}
+
+inline PerfTimerFrequency GetPerfTimerFrequency()
+{
+    return GetOsPerfTimerFrequency();
+}
+#endif // if defined(PERF_TIMER_USE_TSC) && ...
+
+#endif // ifndef PERF_TIMER_H
@@ -26,7 +26,9 @@ SOFTWARE.
 #include <imgui_impl_dx12.h>
 #endif
 #include <imgui_impl_win32.h>
+#include <metrics_gui/capture.h>
 #include <metrics_gui/metrics_gui.h>
+#include <metrics_gui/zone.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <windows.h>
@@ -106,14 +108,32 @@ int main(
     // Note: MetricsGuiPlot does not assume ownership over added metrics, so it
     // is the users responsibility to manage the lifetime of MetricsGuiMetric
     // instances.
-    MetricsGuiMetric frameTimeMetric("Frame time", "s", MetricsGuiMetric::USE_SI_UNIT_PREFIX);
+    MetricsGuiMetric frameTimeMetric("Frame time", "s", MetricsGuiMetric::USE_SI_UNIT_PREFIX | MetricsGuiMetric::TRACK_PERCENTILES | MetricsGuiMetric::TRACK_TIMESTAMPS);
     frameTimeMetric.mSelected = true;
+    frameTimeMetric.EnableHistogram(0, 0.001f, 0.1f, MetricsGuiHistogram::SI_DECADES);
 
-    MetricsGuiMetric sineMetric("Sine", "", MetricsGuiMetric::KNOWN_MIN_VALUE | MetricsGuiMetric::KNOWN_MAX_VALUE);
+    MetricsGuiMetric sineMetric("Sine", "", MetricsGuiMetric::KNOWN_MIN_VALUE | MetricsGuiMetric::KNOWN_MAX_VALUE | MetricsGuiMetric::HISTORY_UNORM16);
     sineMetric.mKnownMinValue = -1.f;
     sineMetric.mKnownMaxValue = 1.f;
     sineMetric.mSelected = true;
 
+    // Zones accumulate the time spent in METRICS_GUI_ZONE() scopes, and add
+    // it to their history when committed each frame.
+    MetricsGuiZone frameZone("CPU frame");
+    MetricsGuiZone renderZone("CPU render");
+
+    // A timeline records zone events, and draws the zones of one frame.
+    MetricsGuiTimeline timeline;
+
+    // A capture writer records metric values to a file each frame.
+    MetricsGuiMetric const* capturedMetrics[] = { &frameTimeMetric, &sineMetric, &frameZone, &renderZone };
+    MetricsGuiCaptureWriter capture;
+    bool recordCapture = false;
+
+    MetricsGuiPlot capturePlot;
+    capturePlot.mShowInlineGraphs = true;
+    capturePlot.AddMetric(&capture.mOverheadMetric);
+
     // Metrics are drawn using a MetricsGuiPlot.  MetricsGuiPlot holds pointers
     // to one or more metrics, and maintains value extents for the metrics
     // added to it.
@@ -142,6 +162,9 @@ int main(
     listPlot.mShowLegendMax = true;
     listPlot.AddMetric(&frameTimeMetric);
     listPlot.AddMetric(&sineMetric);
+    listPlot.AddMetric(&frameZone);
+    listPlot.AddMetric(&frameZone.mSelfMetric);
+    listPlot.AddMetric(&renderZone);
     listPlot.SortMetricsByName();
 
     MetricsGuiPlot combinedPlot;
@@ -154,6 +177,9 @@ int main(
     combinedPlot.AddMetric(&frameTimeMetric);
     combinedPlot.AddMetric(&sineMetric);
 
+    MetricsGuiPlot histogramPlot;
+    histogramPlot.AddMetric(&frameTimeMetric);
+
     // Create D3D implementation instance
     char title[1024] = {};
     auto titleIdx = sprintf_s(title, "MetricsGui sample");
@@ -240,6 +266,10 @@ int main(
         // Wait for D3D resources to be available
         auto resourcesIndex = implD3D->WaitForResources();
 
+        // Time the rest of the frame
+        timeline.MarkFrame();
+        METRICS_GUI_ZONE(frameZone);
+
         // Specify GUI
         if (d3d11) {
             ImGui_ImplDX11_NewFrame();
@@ -257,11 +287,20 @@ int main(
         frameTimeMetric.AddNewValue(1.f / ImGui::GetIO().Framerate);
         sineMetric.AddNewValue((float) sin((double) (t.QuadPart - t0.QuadPart) / freq.QuadPart));
 
+        // Zones commit the time of completed timers, so frameZone commits the
+        // previous frame here.
+        frameZone.Commit();
+        renderZone.Commit();
+
+        // Record the values added this frame.
+        capture.RecordFrame();
+
         // After adding metric values, update all the plot axes.
         frameTimePlot.UpdateAxes();
         sinePlot.UpdateAxes();
         listPlot.UpdateAxes();
         combinedPlot.UpdateAxes();
+        capturePlot.UpdateAxes();
 
         // Create a ImGui window to display the metrics in.
         if (ImGui::Begin("Metrics Window")) {
@@ -309,12 +348,15 @@ int main(
                         ImGui::SliderInt("mPlotRowCount##1",      &plotRowCount, 1, 10);
                         ImGui::SliderInt("mVBarMinWidth##1",      &vbarMinWidth, 1, 20);
                         ImGui::SliderInt("mVBarGapWidth##1",      &vbarGapWidth, 0, 10);
+                        ImGui::SliderFloat("mTimeWindow##1",      &frameTimePlot.mTimeWindow, 0.f, 10.f, "%.1f s");
                         ImGui::Checkbox("mShowAverage##1",        &frameTimePlot.mShowAverage);
+                        ImGui::Checkbox("mShowPercentiles##1",    &frameTimePlot.mShowPercentiles);
                         ImGui::Checkbox("mShowOnlyIfSelected##1", &frameTimePlot.mShowOnlyIfSelected);
                         ImGui::Checkbox("mShowLegendDesc##1",     &frameTimePlot.mShowLegendDesc);
                         ImGui::Checkbox("mShowLegendColor##1",    &frameTimePlot.mShowLegendColor);
                         ImGui::Checkbox("mShowLegendUnits##1",    &frameTimePlot.mShowLegendUnits);
                         ImGui::Checkbox("mShowLegendAverage##1",  &frameTimePlot.mShowLegendAverage);
+                        ImGui::Checkbox("mShowLegendPercentiles##1", &frameTimePlot.mShowLegendPercentiles);
                         ImGui::Checkbox("mShowLegendMin##1",      &frameTimePlot.mShowLegendMin);
                         ImGui::Checkbox("mShowLegendMax##1",      &frameTimePlot.mShowLegendMax);
                         ImGui::Checkbox("mBarGraph##1",           &frameTimePlot.mBarGraph);
@@ -328,11 +370,13 @@ int main(
                         sinePlot.mVBarMinWidth       = frameTimePlot.mVBarMinWidth;
                         sinePlot.mVBarGapWidth       = frameTimePlot.mVBarGapWidth;
                         sinePlot.mShowAverage        = frameTimePlot.mShowAverage;
+                        sinePlot.mShowPercentiles    = frameTimePlot.mShowPercentiles;
                         sinePlot.mShowOnlyIfSelected = frameTimePlot.mShowOnlyIfSelected;
                         sinePlot.mShowLegendDesc     = frameTimePlot.mShowLegendDesc;
                         sinePlot.mShowLegendColor    = frameTimePlot.mShowLegendColor;
                         sinePlot.mShowLegendUnits    = frameTimePlot.mShowLegendUnits;
                         sinePlot.mShowLegendAverage  = frameTimePlot.mShowLegendAverage;
+                        sinePlot.mShowLegendPercentiles = frameTimePlot.mShowLegendPercentiles;
                         sinePlot.mShowLegendMin      = frameTimePlot.mShowLegendMin;
                         sinePlot.mShowLegendMax      = frameTimePlot.mShowLegendMax;
                         sinePlot.mBarGraph           = frameTimePlot.mBarGraph;
@@ -376,6 +420,32 @@ int main(
                 }
             }
             ImGui::Spacing();
+
+            if (ImGui::CollapsingHeader("MetricsGuiPlot::DrawHistogram()", ImGuiTreeNodeFlags_CollapsingHeader | ImGuiTreeNodeFlags_DefaultOpen)) {
+                histogramPlot.DrawHistogram();
+            }
+            ImGui::Spacing();
+
+            if (ImGui::CollapsingHeader("MetricsGuiTimeline::DrawTimeline()", ImGuiTreeNodeFlags_CollapsingHeader | ImGuiTreeNodeFlags_DefaultOpen)) {
+                int selectedFrame = (int) timeline.mSelectedFrame;
+                ImGui::SliderInt("mSelectedFrame", &selectedFrame, 0, MetricsGuiTimeline::NUM_FRAMES - 2);
+                timeline.mSelectedFrame = (uint32_t) selectedFrame;
+                timeline.DrawTimeline();
+            }
+            ImGui::Spacing();
+
+            if (ImGui::CollapsingHeader("MetricsGuiCaptureWriter", ImGuiTreeNodeFlags_CollapsingHeader)) {
+                if (ImGui::Checkbox("Record sample.mgc", &recordCapture)) {
+                    if (recordCapture) {
+                        recordCapture = capture.Open("sample.mgc", capturedMetrics, (uint32_t) _countof(capturedMetrics));
+                    } else {
+                        capture.Close();
+                    }
+                }
+                ImGui::Text("%llu frames recorded, %llu dropped", capture.mFrameCount, capture.mDroppedFrameCount);
+                capturePlot.DrawList();
+            }
+            ImGui::Spacing();
         }
         ImGui::End();
 
@@ -383,7 +453,10 @@ int main(
         ImGui::Render();
 
         // Render the scene (a single triangle in this sample).
-        implD3D->Render(resourcesIndex);
+        {
+            METRICS_GUI_ZONE(renderZone);
+            implD3D->Render(resourcesIndex);
+        }
     }
 
     return 0;
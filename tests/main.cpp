@@ -0,0 +1,464 @@
+/*
+Copyright 2017 Intel Corporation
+
+Permission is hereby granted, free of charge, to any person obtaining a copy of
+this software and associated documentation files (the "Software"), to deal in
+the Software without restriction, including without limitation the rights to
+use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+of the Software, and to permit persons to whom the Software is furnished to do
+so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+
+// Regression tests of MetricsGui behavior that is easy to break without
+// noticing in the sample.  Runs every test, or only those named on the
+// command line, and returns non-zero if any check fails.
+
+#define NOMINMAX // perf_timer.h includes windows.h on Windows
+#include "../imgui/imgui.h"
+#include <metrics_gui/capture.h>
+#include <metrics_gui/metrics_gui.h>
+#include <metrics_gui/zone.h>
+#include <math.h>
+#include <new>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+// Heap allocations made while gCountAllocations is set, through operator new
+// or ImGui's allocator.  Only set while a single thread is running.
+uint32_t gAllocationCount = 0;
+bool gCountAllocations = false;
+
+void* operator new(
+    size_t size)
+{
+    if (gCountAllocations) {
+        gAllocationCount += 1;
+    }
+    auto p = malloc(size == 0 ? 1 : size);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(
+    void* p) noexcept
+{
+    free(p);
+}
+
+void operator delete(
+    void* p,
+    size_t size) noexcept
+{
+    (void) size;
+    free(p);
+}
+
+namespace {
+
+uint32_t gFailureCount = 0;
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        fprintf(stderr, "%s(%d): check failed: %s\n", __FILE__, __LINE__, #condition); \
+        gFailureCount += 1; \
+    } \
+} while (0)
+
+// Before the history fills, the unfilled values of a UNORM history hold the
+// value of its range nearest zero, which must not be averaged, nor be the
+// minimum or a percentile.
+void TestUnormPartialHistory()
+{
+    uint32_t formats[] = { MetricsGuiMetric::HISTORY_UNORM16, MetricsGuiMetric::HISTORY_UNORM8 };
+    for (auto format : formats) {
+        MetricsGuiMetric metric("UNORM", "", format | MetricsGuiMetric::KNOWN_MIN_VALUE | MetricsGuiMetric::KNOWN_MAX_VALUE | MetricsGuiMetric::TRACK_PERCENTILES, 16);
+        metric.mKnownMinValue = 10.f;
+        metric.mKnownMaxValue = 20.f;
+
+        metric.AddNewValue(15.f);
+        CHECK(fabsf(metric.GetAverageValue() - 15.f) < 0.05f);
+        CHECK(metric.GetHistoryMinValue() == metric.GetLastValue());
+        CHECK(metric.GetHistoryMaxValue() == metric.GetLastValue());
+        CHECK(metric.GetPercentileValue(0.f) == metric.GetLastValue());
+
+        // Setting an unfilled value doesn't add it to the history
+        metric.AddNewValue(19.f);
+        metric.SetLastValue(12.f, 9);
+        CHECK(fabsf(metric.GetAverageValue() - 17.f) < 0.05f);
+        CHECK(metric.GetHistoryMinValue() > 14.f);
+
+        for (int i = 0; i < 40; ++i) {
+            metric.AddNewValue(18.f);
+        }
+        CHECK(fabsf(metric.GetAverageValue() - 18.f) < 0.05f);
+        CHECK(metric.GetHistoryMinValue() > 17.5f);
+    }
+}
+
+// Unregistering a metric must not hide metrics registered after it that
+// collided with it in the registry's hash table.
+void TestRegistryUnregister()
+{
+    enum { METRIC_COUNT = 200 };
+
+    MetricsGuiRegistry registry;
+    MetricsGuiMetric metrics[METRIC_COUNT];
+    for (uint32_t i = 0; i < METRIC_COUNT; ++i) {
+        char description[32];
+        snprintf(description, sizeof(description), "metric %u", i);
+        metrics[i].Initialize(description, "", 0);
+        CHECK(registry.RegisterMetric(&metrics[i]));
+    }
+
+    for (uint32_t i = 0; i < METRIC_COUNT; i += 3) {
+        CHECK(registry.UnregisterMetric(&metrics[i]));
+    }
+    CHECK(!registry.UnregisterMetric(&metrics[0]));
+    for (uint32_t i = 0; i < METRIC_COUNT; ++i) {
+        auto registered = i % 3 != 0;
+        CHECK(registry.FindMetric(metrics[i].mDescription) == (registered ? &metrics[i] : nullptr));
+    }
+    CHECK(registry.mMetrics.size() == METRIC_COUNT - (METRIC_COUNT + 2) / 3);
+
+    for (uint32_t i = 0; i < METRIC_COUNT; ++i) {
+        registry.UnregisterMetric(&metrics[i]);
+    }
+    CHECK(registry.mMetrics.empty());
+}
+
+// Zone shards are never reset, so each Commit() must add only the ticks
+// added since the last one, including those of threads sharing the extra
+// shard because there are more threads than shards.
+void TestZoneCommitDifferences()
+{
+    enum { THREAD_COUNT = 4, TICKS_PER_THREAD = 1000 };
+
+    MetricsGuiZone zone("Zone", MetricsGuiMetric::NONE, 16, 2);
+    for (uint32_t commit = 0; commit < 2; ++commit) {
+        std::vector<std::thread> threads;
+        for (uint32_t i = 0; i < THREAD_COUNT; ++i) {
+            threads.emplace_back([&zone]() {
+                auto thread = &MetricsGuiZoneThread::Get();
+                for (uint32_t j = 0; j < TICKS_PER_THREAD; ++j) {
+                    zone.AddTicks(thread, 2, 1);
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        zone.Commit();
+        auto ticks = (double) (THREAD_COUNT * TICKS_PER_THREAD);
+        CHECK(zone.GetLastValue() == (float) (2. * ticks * zone.mSecondsPerTick));
+        CHECK(zone.mSelfMetric.GetLastValue() == (float) (ticks * zone.mSecondsPerTick));
+    }
+    zone.Commit();
+    CHECK(zone.GetLastValue() == 0.f);
+}
+
+// Replayed values are timestamped on the replay clock, keeping their
+// captured spacing, and replaying an earlier window replaces the history.
+void TestCaptureReplayTimestamps()
+{
+    enum { FRAME_COUNT = 100, HISTORY_SIZE = 64 };
+    char const* path = "tests_replay.mgc";
+
+    MetricsGuiMetric captured("Captured", "", MetricsGuiMetric::TRACK_TIMESTAMPS);
+    MetricsGuiMetric const* capturedMetrics[] = { &captured };
+    MetricsGuiCaptureWriter writer;
+    // One chunk, so that no frames are dropped waiting for the writer thread
+    CHECK(writer.Open(path, capturedMetrics, 1, FRAME_COUNT));
+    for (uint32_t frame = 0; frame < FRAME_COUNT; ++frame) {
+        captured.AddNewValue((float) frame);
+        writer.RecordFrame(1000 + frame * 10);
+    }
+    CHECK(writer.Close());
+
+    {
+        MetricsGuiCaptureReader reader;
+        CHECK(reader.Open(path));
+        MetricsGuiMetric replayed;
+        reader.InitializeMetric(0, &replayed, HISTORY_SIZE);
+        MetricsGuiMetric* replayedMetrics[] = { &replayed };
+
+        auto before = GetPerfTimerCount();
+        reader.Replay(50, 100, replayedMetrics);
+        auto after = GetPerfTimerCount();
+        CHECK(replayed.mHistoryCount == 50);
+        CHECK(replayed.GetLastValue() == 99.f);
+        auto last = replayed.GetTimestamp(HISTORY_SIZE - 1);
+        CHECK(before <= last && last <= after);
+        CHECK(last - replayed.GetTimestamp(HISTORY_SIZE - 50) == 49 * 10);
+
+        reader.Replay(0, 50, replayedMetrics);
+        CHECK(replayed.mHistoryCount == 50);
+        CHECK(replayed.GetLastValue() == 49.f);
+        CHECK(replayed.GetTimestamp(HISTORY_SIZE - 1) >= last);
+    }
+    remove(path);
+}
+
+void* CountingAlloc(
+    size_t size,
+    void* userData)
+{
+    (void) userData;
+    if (gCountAllocations) {
+        gAllocationCount += 1;
+    }
+    return malloc(size);
+}
+
+void CountingFree(
+    void* p,
+    void* userData)
+{
+    (void) userData;
+    free(p);
+}
+
+void CreateTestContext()
+{
+    ImGui::CreateContext();
+    auto& io = ImGui::GetIO();
+    io.DisplaySize = ImVec2(1280.f, 720.f);
+    io.DeltaTime = 1.f / 60.f;
+    io.IniFilename = nullptr;
+    unsigned char* pixels = nullptr;
+    int width = 0;
+    int height = 0;
+    io.Fonts->GetTexDataAsRGBA32(&pixels, &width, &height);
+}
+
+// Once the histories are full, drawing plots of every kind reuses the
+// buffers of earlier frames rather than allocating.
+void TestDrawWithoutAllocations()
+{
+    enum { PLOT_COUNT = 8, METRICS_PER_PLOT = 6 };
+
+    ImGui::SetAllocatorFunctions(CountingAlloc, CountingFree);
+    CreateTestContext();
+
+    {
+        MetricsGuiMetric metrics[PLOT_COUNT * METRICS_PER_PLOT];
+        MetricsGuiPlot plots[PLOT_COUNT];
+        for (auto& metric : metrics) {
+            metric.Initialize("Metric", "s", MetricsGuiMetric::USE_SI_UNIT_PREFIX);
+        }
+        for (uint32_t i = 0; i < PLOT_COUNT; ++i) {
+            plots[i].mShowInlineGraphs = true;
+            plots[i].mShowAverage = (i & 1) != 0;
+            plots[i].mBarGraph = (i & 2) != 0;
+            plots[i].mStacked = (i & 4) != 0;
+            plots[i].AddMetrics(&metrics[i * METRICS_PER_PLOT], METRICS_PER_PLOT);
+        }
+
+        uint32_t const WARM_UP_FRAMES = 2 * MetricsGuiMetric::NUM_HISTORY_SAMPLES;
+        uint32_t const FRAME_COUNT = WARM_UP_FRAMES + 100;
+        for (uint32_t frame = 0; frame < FRAME_COUNT; ++frame) {
+            for (uint32_t i = 0; i < PLOT_COUNT * METRICS_PER_PLOT; ++i) {
+                metrics[i].AddNewValue(0.001f * (float) ((frame * 7 + i * 3) % 13 + 1));
+            }
+            for (auto& plot : plots) {
+                plot.UpdateAxes();
+            }
+
+            ImGui::NewFrame();
+            ImGui::SetNextWindowSize(ImVec2(1200.f, 700.f));
+            ImGui::Begin("Plots");
+            gCountAllocations = frame >= WARM_UP_FRAMES;
+            for (uint32_t i = 0; i < PLOT_COUNT; ++i) {
+                if (((frame + i) & 1) != 0) {
+                    plots[i].DrawHistory();
+                } else {
+                    plots[i].DrawList();
+                }
+            }
+            gCountAllocations = false;
+            ImGui::End();
+            ImGui::Render();
+        }
+        CHECK(gAllocationCount == 0);
+    }
+
+    ImGui::DestroyContext();
+}
+
+// A plot's axis range covers the values it draws: once it knows its width,
+// UpdateAxes() selects the archived values a plot at least as wide as the
+// values it spans draws, rather than the tier buckets a narrower one would.
+void TestAxesMatchPlotWidth()
+{
+    enum { HISTORY_SIZE = 256, PLOT_LENGTH = 512, VALUE_COUNT = 866, SPIKE_AGE = 500 };
+
+    CreateTestContext();
+    {
+        uint32_t samplesPerBucket = 64;
+        MetricsGuiMetric metric("Tiered", "", 0, HISTORY_SIZE);
+        metric.EnableHistoryTiers(&samplesPerBucket, 1);
+        metric.EnableHistoryArchive(4096);
+        for (uint32_t i = 0; i < VALUE_COUNT; ++i) {
+            metric.AddNewValue(i == VALUE_COUNT - SPIKE_AGE ? 100.f : 1.f);
+        }
+
+        MetricsGuiPlot plot;
+        plot.mHistoryLength = PLOT_LENGTH;
+        plot.mRangeDampening = 0.f;
+        plot.AddMetric(&metric);
+        for (uint32_t frame = 0; frame < 2; ++frame) {
+            plot.UpdateAxes();
+
+            ImGui::NewFrame();
+            ImGui::SetNextWindowSize(ImVec2(1200.f, 700.f));
+            ImGui::Begin("Plot");
+            plot.DrawHistory();
+            ImGui::End();
+            ImGui::Render();
+        }
+        CHECK(plot.mPlotWidth > PLOT_LENGTH);
+
+        plot.UpdateAxes();
+        CHECK(plot.mMaxValue == 100.f);
+    }
+    ImGui::DestroyContext();
+}
+
+// With unchanging values, the dampened axis range reaches its target
+// exactly, so that DrawHistory() can replay its geometry.
+void TestAxesSettle()
+{
+    CreateTestContext();
+    {
+        MetricsGuiMetric metrics[2];
+        for (uint32_t i = 0; i < 2; ++i) {
+            metrics[i].Initialize("Metric", "", 0);
+            for (uint32_t j = 0; j < MetricsGuiMetric::NUM_HISTORY_SAMPLES; ++j) {
+                metrics[i].AddNewValue((float) ((j * 5 + i) % 11));
+            }
+        }
+
+        MetricsGuiPlot plot;
+        plot.mSharedAxis = true;
+        plot.AddMetrics(metrics, 2);
+        plot.UpdateAxes();
+        metrics[0].AddNewValue(100.f);
+        for (uint32_t frame = 0; frame < 200; ++frame) {
+            plot.UpdateAxes();
+
+            ImGui::NewFrame();
+            ImGui::SetNextWindowSize(ImVec2(1200.f, 700.f));
+            ImGui::Begin("Plot");
+            plot.DrawHistory();
+            ImGui::End();
+            ImGui::Render();
+        }
+        CHECK(plot.mMaxValue == plot.mMetricTargetRange[0].second);
+        CHECK(plot.mMinValue == plot.mMetricTargetRange[0].first);
+        CHECK(plot.mMetricRange[1] == plot.mMetricTargetRange[1]);
+    }
+    ImGui::DestroyContext();
+}
+
+// A plot spanning an archive without tiers reads it in runs of about a
+// pixel each, and caches no more than an aggregate per run, rather than
+// every decoded value.
+void TestArchivePlotMemory()
+{
+    enum { HISTORY_SIZE = 256, ARCHIVE_SIZE = 24 * 60 * 60 };
+
+    CreateTestContext();
+    {
+        MetricsGuiMetric metric("Memory", "B", 0, HISTORY_SIZE);
+        metric.EnableHistoryArchive(ARCHIVE_SIZE);
+        for (uint32_t i = 0; i < HISTORY_SIZE + ARCHIVE_SIZE; ++i) {
+            metric.AddNewValue((float) (1000 + i / 600));
+        }
+        auto archiveSize = metric.mArchive->GetMemorySize();
+
+        MetricsGuiPlot plot;
+        plot.mHistoryLength = HISTORY_SIZE + ARCHIVE_SIZE;
+        plot.AddMetric(&metric);
+        for (uint32_t frame = 0; frame < 100; ++frame) {
+            metric.AddNewValue(2000.f);
+            plot.UpdateAxes();
+
+            ImGui::NewFrame();
+            ImGui::SetNextWindowSize(ImVec2(1200.f, 700.f));
+            ImGui::Begin("Plot");
+            plot.DrawHistory();
+            ImGui::End();
+            ImGui::Render();
+        }
+        CHECK(metric.mArchive->GetMemorySize() <= archiveSize + plot.mPlotWidth * sizeof(MetricsGuiAggregate));
+    }
+    ImGui::DestroyContext();
+}
+
+struct Test {
+    char const* mName;
+    void (*mRun)();
+};
+
+Test const TESTS[] = {
+    { "unorm_partial_history", TestUnormPartialHistory },
+    { "draw_without_allocations", TestDrawWithoutAllocations },
+    { "registry_unregister", TestRegistryUnregister },
+    { "zone_commit_differences", TestZoneCommitDifferences },
+    { "capture_replay_timestamps", TestCaptureReplayTimestamps },
+    { "axes_match_plot_width", TestAxesMatchPlotWidth },
+    { "axes_settle", TestAxesSettle },
+    { "archive_plot_memory", TestArchivePlotMemory },
+};
+
+} // anon namespace
+
+int main(
+    int argc,
+    char** argv)
+{
+    for (int i = 1; i < argc; ++i) {
+        auto found = false;
+        for (auto const& test : TESTS) {
+            found = found || strcmp(argv[i], test.mName) == 0;
+        }
+        if (!found) {
+            fprintf(stderr, "usage: tests.exe [test ...]\n");
+            fprintf(stderr, "tests:\n");
+            for (auto const& test : TESTS) {
+                fprintf(stderr, "    %s\n", test.mName);
+            }
+            return 1;
+        }
+    }
+
+    for (auto const& test : TESTS) {
+        auto run = argc == 1;
+        for (int i = 1; i < argc; ++i) {
+            run = run || strcmp(argv[i], test.mName) == 0;
+        }
+        if (run) {
+            auto failureCount = gFailureCount;
+            test.mRun();
+            printf("%s: %s\n", test.mName, gFailureCount == failureCount ? "passed" : "FAILED");
+        }
+    }
+    return gFailureCount == 0 ? 0 : 1;
+}